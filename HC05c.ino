@@ -11,7 +11,7 @@ THE LIABILITY MAY BE ASSERTED, EVEN IF ADVISED OF THE POSSIBILITY OR LIKELIHOOD
 OF SUCH DAMAGES.
 */
 
-#include <disk91_hc05.h>
+#include <HC05c.h>
 
 HC05c hc05;
 
@@ -22,7 +22,7 @@ void setup()
   Serial.begin(9600); // Allow Serial communication via USB cable to computer (if required)
   while (!Serial) ; // whait for Serial to be open on desktop (re-open in case of reset)
                     // Seems that after loading code, this pause it not taken into account...
-  print_debug("Entering setup()");
+  Serial.println("Entering setup()");
 
   for ( int i = 0 ; i < 2 ; i++ ) {
    digitalWrite(13,LOW); //Turn off the onboard Arduino LED
@@ -34,7 +34,7 @@ void setup()
 #endif
 
   
- hc05.setupBlueToothConnection("test");
+ hc05.setupConnection("test");
     
 }
 
@@ -43,23 +43,22 @@ void loop()
   char buf[50];
   int bufd;
   
-  while (1) {
-     // Blocking operation
-     if ( hc05.connect() ) {
+  // Not blocking : pairing moves forward at each call, other work
+  // can be done in loop() meanwhile
+  if ( hc05.poll() ) {
        
-       while ( (bufd = hc05.receive(buf,50)) >= 0 ) {
-           buf[bufd]=0;
-           Serial.print(buf);  
+     if ( (bufd = hc05.receive(buf,50)) > 0 ) {
+         buf[bufd]=0;
+         Serial.print(buf);  
+     }
            
-           if (Serial.available()){
-              bufd = Serial.readBytes(buf,50);
-              buf[bufd]=0; 
-              hc05.send(buf);
-           }
-           
-       }
-     } 
-    
-  }
+     if (Serial.available()){
+        bufd = Serial.readBytes(buf,49);
+        buf[bufd]=0; 
+        hc05.send(buf);
+     }
+  } 
+#if defined(DEBUG) && HC05_LOG_LEVEL > 0
+  HC05Log::drain(Serial,1); // binary log records, decoded on the computer side
+#endif
 }
-
@@ -1,529 +1,941 @@
 #include <HC05c.h>
+#ifdef __AVR__
+#include <EEPROM.h>
+#endif
+
+const char HC05cBase::DEFAULT_PASSWORD[] = "1234";
+const char HC05cBase::BT_RESET[] = "RESET";
+const char HC05cBase::BT_FSAD[] = "FSAD=";
+const char HC05cBase::BT_INIT[] = "INIT";
+const char HC05cBase::CRLF[] = "\r\n";
+const char HC05cBase::BT_DISC[] = "+DISC:";
+
+static const uint32_t BAUD_RATES[] = { HC05_BAUD_RATES };
+#define BAUD_MAGIC 0xB5
+
+#ifdef HC05_METRICS
+static const char * const CMD_NAMES[HC05_CMD_COUNT] = {
+	"AT", "STATE", "ADCN", "MRAD", "RESET", "INIT", "INQ", "INQC",
+	"FSAD", "PAIR", "LINK", "RNAME", "OTHER"
+};
+
+/* --- Class of an AT command, from its name before '=' or '?'
+ */
+uint8_t HC05Metrics::classOf(const char * atcmdstr) {
+	for ( uint8_t k = HC05_CMD_STATE ; k < HC05_CMD_OTHER ; k++ ) {
+		uint8_t n = strlen(CMD_NAMES[k]);
+		if ( strncmp(atcmdstr,CMD_NAMES[k],n) == 0
+		  && ( atcmdstr[n] == 0 || atcmdstr[n] == '=' || atcmdstr[n] == '?' ) ) return k;
+	}
+	return HC05_CMD_OTHER;
+}
+#endif
 
-static const char DEFAULT_PASSWORD = "1234";
-static const char BT_RESET[] = "RESET";
-static const char BT_FSAD[] = "FSAD";
-static const char BT_INIT[] = "INIT";
-static const char CRLF[] = "\r\n";
-
-HC05c::HC05c() {
-   _baud_rates[0] = 38400; 
-   _baud_rates[1] = 38400; 
-   _baud_rates[2] = 115200;
-   _baud_rates[3] = 115200;
-   _baud_rates[4] = 9600;  
-   _baud_rates[5] = 19200; 
-   _baud_rates[6] = 57600; 
-   detected_addressN=0;
+HC05cBase::HC05cBase() {
+   _bauds = BAUD_RATES;
+   _baudN = sizeof(BAUD_RATES)/sizeof(BAUD_RATES[0]);
+   _baud = 0;
+   _baudSaved = 0;
+   _baudStore = NULL;
    _forced_state=ST_NOFORCE;
+   _sub_state=SS_NONE;
+   _to_master=false;
+   _probeOut=false;
+   _lineN=0;
+   _lineAt=0;
+   initSuccess=false;
+   _state=ST_ERROR;
+   _state_ms=0;
+   _state_pin=-1;
+   _rxHead=0;
+   _rxTail=0;
+   _discN=0;
+   _discSkip=false;
+   _discAt=0;
+   _txHead=0;
+   _txTail=0;
+   _inq_cb=NULL;
+   _known=NULL;
+   _atBusy=false;
+   _atOwn=false;
+   _atLate=0;
+   _atLateEnd=0;
+   _atRet=COD_NONE;
+   _atCls=HC05_TO_NONE;
+   _to[HC05_TO_AT].begin(AT_TIMEOUT_MIN,AT_TIMEOUT);
+   _to[HC05_TO_RESET].begin(RESET_TIME_MIN,RESET_TIME);
+   _to[HC05_TO_INIT].begin(INIT_TIME_MIN,INIT_TIME);
+   for ( uint8_t k = 0 ; k < HC05_MAX_NAMES ; k++ ) _names[k].st = NAME_FREE;
+   _nameK=-1;
+   _nameNext=0;
+   _hasLast=false;
+   _recTier=HC05_REC_NONE;
+   memset(&_rec,0,sizeof(_rec));
 }
 
-/* --- Setup Bluetooth HC-05 device to be ready for inquiery
- * Set device name as BT_CAM, passwd 0000, inquiery search_iter 10s to 1 device
- */
-boolean HC05c::setupConnection(char * devName){
-	return setupConnection(devName, DEFAULT_PASSWORD);
-}
-
-boolean HC05c::setupConnection(char * devName, char * passwd) {
-	char _buffer[BUFSZ];
-	print_debug("Entering setupConnection() ");
-	bootup = true;              // device is booting
-	reqPairing = ( getHC05ADCN() == 0 ) ;  // if no device is already paired, request pairing.
-	initSuccess = false;
-	if ( _getConnection() ) {    
-		if ( _getState() != 0 )  {
-			_sendAtCmd(BT_RESET, true);          // If not in state initialized : reset
-			delay(5000);
-		}     
-		if ( _getState() == 0 )  {
-			_sendAtCmd(BT_INIT,true);           // Init SPP
-			delay(2000);
-			strncpy(_buffer,"NAME=",6);
-			strncat(_buffer,devName,10);
-			_sendAtCmd(_buffer,true);    // BT displayed name
-			strncpy(_buffer,"PSWD=",6);
-			strncat(_buffer,passwd,10);
-			_sendAtCmd(_buffer,true);    // BT password
-			_sendAtCmd("UART=38400,0,0",true); // serial over BT rate + Arduino rate (next restart)
-			_sendAtCmd("IAC=9e8b33",true);     // use a Password for pairing
-			_sendAtCmd("CMODE=1",true);        // connect to any address
-			initSuccess = true;
-		}     
-	} else {
-		print_debug("Leaving setupConnection() with error");
-		return false;
+/* --- Use a cache of known devices : they are linked first, in ranked
+ * order, before the module most recent used address and before any
+ * inquiry. NULL to disable
+ */
+void HC05cBase::setKnownCache(HC05KnownCache * cache) {
+	_known = cache;
+}
+
+/* --- Probe the module baudrate in this order (after the last rate found)
+ */
+void HC05cBase::setBaudRates(const uint32_t * rates, uint8_t n) {
+	_bauds = rates;
+	_baudN = n;
+}
+
+/* --- Load the last rate found from storage, it is saved there each time
+ * a different one is found. NULL to disable
+ */
+void HC05cBase::setBaudStorage(HC05Storage * storage) {
+	struct { uint8_t magic; uint32_t rate; } rec;
+	_baudStore = storage;
+	_baudSaved = 0;
+	if ( storage != NULL && storage->load(&rec,sizeof(rec)) && rec.magic == BAUD_MAGIC ) {
+		_baudSaved = rec.rate;
+		_baud = rec.rate;
 	}
-	print_debug("Leaving setupConnection() ");
-	return true;
 }
 
+/* --- The module answered at rate
+ */
+void HC05cBase::_baudFound(uint32_t rate) {
+	struct { uint8_t magic; uint32_t rate; } rec;
+	_baud = rate;
+	if ( _baudStore == NULL || _baudSaved == rate ) return;
+	rec.magic = BAUD_MAGIC;
+	rec.rate = rate;
+	_baudStore->save(&rec,sizeof(rec));
+	_baudSaved = rate;
+}
+
+/* --- Register a function called for each device found by an inquiry
+ * the inquiry stops as soon as the function returns true
+ */
+void HC05cBase::onInquiry(HC05InqCallback cb) {
+	_inq_cb = cb;
+}
 
-/* -------------------------------------------------------------
- * Establsh connection to a device. return only when the connection
- * has been done with true
- * --------------------------------------------------------------
- */
-bool HC05c::connect() {
-	char buf[BUFSZ];
-	int bufd;
-	char recvChar,lrecvChar;
-	int state;
-	uint16_t search_iter=0;
-	if ( ! initSuccess ) return false;
-	while (true) {
-		state=_getState();
-		print_debug2("HC05 State : ",state);
-		switch ( state ) {
-			case ST_INITIALIZED:
-				// On startup, try to connect to existing device, then go for pairing if failed
-				if ( reqPairing ) {
-					reqPairing = false;
-					// Start a pairing process
-					_forceState(ST_SEARCH_FOR_PAIR);
-					search_iter=0;
-				}
-				else {
-					if ( getHC05ADCN() > 0 ) _forceState(ST_PAIRED);
-					// mode sleep à travailler
-					delay(5000); 
-				}
-				break;   
-			// Not a real existing case, just to simplify algorithm
-			case ST_SEARCH_FOR_PAIR:    
-				if ( search_iter == 0 ) {
-					// for the first minute we can start to INQUIRE if someone wants to pair with us as a salve
-					_sendAtCmd("ROLE=0",true);       // slave mode
-					_sendAtCmd("INQ",true);          // Start INQUIERING => change state to pairable  
-					print_debug("HC05 waiting for pairing as a slave");
-					bootup=false;			      // to not re-enter ...
-				} 
-				if ( search_iter < MAX_SLAVE_TIME ) {
-					print_debug2("HC05 is inquiring as slave - ",search_iter);
-					// Start inquiring ... this will change the status for PAIRABLE but we will proceed here
-					// At this point if OK is read it means that we are connected with the device ... Inquiry success and finished with +DISC
-					// already set : blueToothSerial.setTimeout(200);
-					bufd = blueToothSerial.readBytes(buf,BUFSZ);
-					if (bufd >= 2) && buf[0] == 'O' && buf[1] == 'K' ) _forceState(ST_PAIRED);
-					delay(1000);
-					search_iter++;      
-				}
-				else {
-					print_debug("HC05 pairing as master");
-					// At the end of the inquiring delay, start to inquirer in master mode ... 
-					_forceState(ST_NOFORCE);               // Stop Slave inquiring ... reinit
-					_sendAtCmd(BT_RESET, true);          // Reset
-					delay(5000);
-					_sendAtCmd(BT_INIT,true);            // Init SPP
-					delay(2000);
-					// Change mode to connect as a master
-					_sendAtCmd("ROLE=1",true);       // act as master
-					_sendAtCmd("CLASS=0",true);      // search for everything (use 200 for a smartphone)
-					_startInq(MAX_MASTER_TIME); 
-					// Did we found something ?
-					if (  detected_addressN > 0 ) {
-						// First try to connected to already known devices if we have
-						for ( uint8_t k = 0 ; k < detected_addressN ; k++ ) {
-							strncpy(buf,BT_FSAD,BUFSZ);
-							if (_sendAtCmd(strncat(buf,detected_address[k],BUFSZ - 6),true) < 0 ) {
-								// this address is already known ... linking
-								strncpy(buf,"LINK=",BUFSZ);
-								if (_sendAtCmd(strncat(buf,detected_address[k],BUFSZ - 6),false) < 0 ) break;     //link sucess
-							}
-						}
-						// Then try to pair to listed devices
-						for ( uint8_t k = 0 ; k < detected_addressN ; k++ ) {
-							strncpy(buf,BT_FSAD,BUFSZ);
-							if ( _sendAtCmd(strncat(buf,detected_address[k],BUFSZ - 6),true) == COD_FAIL ) {
-							strncpy(buf,"PAIR=",BUFSZ);
-							strnncat(buf,detected_address[k],BUFSZ - 6);
-							strncat(buf,",20",BUFSZ - 14 - 6);
-							if (_sendAtCmd(buf,false) < 0 ) {
-									// pairing  sucess
-									strncpy(buf,"LINK=",BUFSZ);
-									if (_sendAtCmd(strncat(buf,detected_address[k],BUFSZ - 6),false) < 0 ) {
-									_forceState(ST_CONNECTED);
-									break;     //link sucess
-									}
-								}
-							}
-						}
-						}
-						_forceState(ST_NOFORCE);
-				}
-				break;
-			case ST_PAIRABLE:
-				break;
-			case ST_INQUIERING:
-				print_debug("HC05 is inquiering - invalid state");
-				// reset
-				_forceState(ST_NOFORCE);               // Stop Slave inquiering ... reinit
-				_sendAtCmd(BT_RESET, true);          // Reset
-				delay(5000);
-				_sendAtCmd(BT_INIT,true);            // Init SPP
-				delay(2000);
-				break;
-			case ST_PAIRED:
-				print_debug("HC05 is paired to a device");
-				if ( getHC05Mrad() ) {
-					// Connect to the last device if possible
-					strncpy(buf,"LINK=",BUFSZ);
-					if (_sendAtCmd(strncat(buf,detected_address[0],BUFSZ - 6),false) < 0 ) {
-					 _forceState(ST_CONNECTED);
-					}
-					else {
-						// If connection not succeed, back to standard process ...
-						_sendAtCmd(" ",true); // it seems that after a AT+LINK the next AT command is not concidered
-						// When connection fail, if at bootup, we start a new pairing process
-						if ( bootup ) {
-							reqPairing = true;                  
-							_forceState(ST_NOFORCE); 
-						}
-					}
-				}
-				bootup = false; // bootup period is finished after first pairing try
-				break;
-			case ST_DISCONNECTED:
-				print_debug("Disconnection detected");
-				_sendAtCmd(BT_RESET, true);          // If not in state initialized : reset
-				delay(5000);
-				_sendAtCmd(BT_INIT,true);            // Init SPP
-				delay(2000);
-				break;
-			case ST_CONNECTED:
-				print_debug("Device Connected");
-				return true;
-			default:
-				delay(1000);
-				break;
-		}
+/* --- Use the HC05 STATE pin (high when a link is up) to follow the
+ * connection without AT traffic. pin < 0 to disable
+ */
+void HC05cBase::setStatePin(int8_t pin) {
+	_state_pin = pin;
+	if ( pin >= 0 ) pinMode(pin,INPUT);
+}
+
+/* --- Enter a sub-state ending at deadline
+ */
+void HC05cBase::_wait(uint8_t sub_state, uint32_t deadline) {
+	_sub_state = sub_state;
+	_deadline = deadline;
+	_since = millis();
+}
+
+/* --- Link lost : start with the first tier that applies, relinking
+ * needs a device connected before
+ */
+void HC05cBase::_recoverStart(uint32_t now) {
+	_recTier = _hasLast?HC05_REC_LINK:HC05_REC_RESET;
+	_recTry = 0;
+	_recStart = now;
+	_recSince = now;
+	_rec.runs[_recTier]++;
+	hc05_log(HC05_LVL_STEP,HC05_CAT_STATE,RECOVER,_recTier);
+	_wait(SS_RECOVER,now);
+}
+
+/* --- The recovery attempt failed : try again after the backoff delay or
+ * go to the next tier
+ */
+void HC05cBase::_recoverNext(uint32_t now) {
+	if ( _recTier == HC05_REC_LINK && ++_recTry < HC05_RELINK_TRIES ) {
+		_wait(SS_RECOVER,now + ( (uint32_t)HC05_RELINK_DELAY << ( _recTry - 1 ) ));
+		return;
 	}
+	_rec.ms[_recTier] += now - _recSince;
+	_recTier++;
+	_recTry = 0;
+	_recSince = now;
+	_rec.runs[_recTier]++;
+	hc05_log(HC05_LVL_STEP,HC05_CAT_STATE,RECOVER,_recTier);
+	_wait(SS_RECOVER,now);
+}
+
+/* --- Connected again
+ */
+void HC05cBase::_recoverEnd(uint32_t now) {
+	if ( _recTier == HC05_REC_NONE ) return;
+	_rec.ms[_recTier] += now - _recSince;
+	_rec.ok[_recTier]++;
+	_rec.lastMs = now - _recStart;
+	hc05_log(HC05_LVL_STEP,HC05_CAT_STATE,RECOVERED,_rec.lastMs);
+	_recTier = HC05_REC_NONE;
+}
+
+/* --- No link to a known device nor to the most recent used address
+ */
+void HC05cBase::_mradFailed(uint32_t now) {
+	// If connection not succeed, back to standard process ...
+	// When connection fail, if at bootup, we start a new pairing process
+	if ( bootup ) {
+		reqPairing = true;                  
+		_forceState(ST_NOFORCE); 
+	} else _wait(SS_SLEEP,now + RETRY_TIME);
+	bootup = false; // bootup period is finished after first pairing try
 }
 
 /* ---------------------------------------------------------------
- * Receive string from bluetooth - not blocking operation
- * return number of char received
- * return -1 when the connection is broken
+ * Zero-copy access to the receive buffer - not blocking operation
+ * data is set to the oldest byte received, return the number of bytes
+ * readable there. Bytes stay in the buffer until consume() is called
  * ---------------------------------------------------------------
  */
-int HC05c::receive(char * buf, int maxsz) {
-	int16_t bufd;
-	if ( _getState() != ST_CONNECTED ) return -1;
-	// We are waiting for +DISC command now on blueToothSerial to quit the connection mode
-	bufd = blueToothSerial.readBytes(buf,BUFSZ);
-	if (bufd > 0 ) {
-		if (bufd > 5) {
-			if ( buf[0] == '+' && buf[1] == 'D' && buf[2] == 'I' && buf[3] == 'S' && buf[4] == 'C' ) {
-				// detect disconnection
-				_forceState(ST_NOFORCE);
-				return -1;
-			} 
-		}
-		buf[bufd]=0;
-	}
-	return bufd;
+uint16_t HC05cBase::peek(const uint8_t ** data) {
+	uint16_t start = _rxTail & (RX_BUFSZ - 1);
+	uint16_t n = _rxHead - _rxTail;
+	if ( n > RX_BUFSZ - start ) n = RX_BUFSZ - start;
+	*data = &_rx[start];
+	return n;
+}
+
+void HC05cBase::consume(uint16_t n) {
+	uint16_t avail = _rxHead - _rxTail;
+	_rxTail += ( n < avail )?n:avail;
 }
 
 /* ---------------------------------------------------------------
- * Send string over bluetooth - blocking operation
- * return false if disconnected
+ * Number of bytes waiting in the transmit buffer
  * ---------------------------------------------------------------
  */
-boolean HC05c::send(char * buf) {
-	if ( _getState() != ST_CONNECTED ) return false;
-	blueToothSerial.print(buf);
+uint16_t HC05cBase::txPending() {
+	return _txHead - _txTail;
+}
+
+/* --- Force a specific state as the HC05 does not commute as I could expect
+ * Once the state is forced, the device is not anymore Inquiery for State until
+ * this forced state is back to ST_ERROR
+ */
+void HC05cBase::_forceState(int16_t state) {
+	_forced_state=state;
+	HC05_METRIC(_noteState());
+}
+
+/* --- Copy data at the end of the transmit buffer
+ * return the number of bytes copied
+ */
+size_t HC05cBase::_txQueue(const uint8_t * data, size_t len) {
+	size_t done = 0;
+	while ( done < len && (uint16_t)(_txHead - _txTail) < TX_BUFSZ ) {
+		_tx[_txHead & (TX_BUFSZ - 1)] = data[done++];
+		_txHead++;
+	}
+	return done;
+}
+
+/* --- Link is down : forget the forced state and remember the disconnection
+ * so the next _getState() does not need to ask the module
+ */
+void HC05cBase::_setDisconnected() {
+	_state = ST_DISCONNECTED;
+	_state_ms = millis();
+	_forceState(ST_NOFORCE);
+}
+
+/* --- Get the state without any AT traffic - used on the data path
+ * return the forced state, or the last known state updated by +DISC
+ * detection and the STATE pin
+ */
+int16_t HC05cBase::_cachedState() {
+	if ( _state_pin >= 0 && digitalRead(_state_pin) == LOW
+	  && ( _forced_state == ST_CONNECTED || ( _forced_state == ST_NOFORCE && _state == ST_CONNECTED ) ) ) {
+		_setDisconnected();
+	}
+	return ( _forced_state != ST_NOFORCE )?_forced_state:_state;
+}
+
+/* --- Parse an inquiry result line
+ * format : +INQ:aaaa:aa:aaaa,ttttt,ppppp (address, class, rssi)
+ * a new address is added to _detected and given to the callback
+ * return true when the inquiry must be stopped
+ */
+bool HC05cBase::_inqLine(const char * line) {
+	HC05Addr addr;
+	const char * p;
+	uint32_t cod = 0;
+	int16_t rssi = 0;
+	if ( strncmp(line,"+INQ:",5) != 0 ) return false;
+	p = addr.parse(line + 5);
+	if ( p == NULL ) return false;
+	if ( *p == ',' ) cod = strtoul(p + 1,(char **)&p,16);
+	if ( *p == ',' ) rssi = (int16_t)strtoul(p + 1,NULL,16);
+	if ( ! _detected.add(addr) ) return false;      // already known
+	hc05_log(HC05_LVL_STEP,HC05_CAT_INQ,INQ_FOUND,addr.lap());
+	if ( _inq_cb != NULL && _inq_cb(addr,cod,rssi) ) return true;
+	// a known device is in range, no need to wait for others
+	if ( _known != NULL && _known->seen(addr,rssi) ) return true;
+	return _detected.full();                        // No place left on table, stop
+}
+
+/* --- Build an AT command made of cmd followed by addr
+ * return buf
+ */
+char * HC05cBase::_addrCmd(char * buf, const char * cmd, const HC05Addr & addr) {
+	uint8_t k = strlen(cmd);
+	memcpy(buf,cmd,k);
+	addr.format(&buf[k],',');
+	return buf;
+}
+
+/* --- Cancel the asynchronous AT command
+ */
+void HC05cBase::atCancel() {
+	if ( ! _atBusy ) return;
+	HC05_METRIC(_metrics.result(COD_TIMEOUT,millis()));
+	_atLate++;
+	_atLateEnd = _atDeadline;
+	_atDone(COD_CANCEL);
+}
+
+/* --- The asynchronous AT command is over, give its result to the callback
+ */
+void HC05cBase::_atDone(int16_t ret) {
+	_atBusy = false;
+	if ( _atCls != HC05_TO_NONE ) {
+		if ( ret == COD_TIMEOUT ) _to[_atCls].expired();
+		else if ( ret != COD_CANCEL ) _to[_atCls].sample(millis() - _atSent);
+	}
+	_atRet = ret;
+	if ( _atCb != NULL ) _atCb(ret,_atCtx);
+}
+
+/* --- Queue a remote name request, nothing is sent here : tick() sends
+ * RNAME? when the module is idle between two connection steps. A name
+ * already resolved is kept, a failed one is asked again. When the table
+ * is full the entries are replaced in turn.
+ */
+bool HC05cBase::requestName(const HC05Addr & addr) {
+	int16_t k = _nameFind(addr);
+	if ( k >= 0 ) {
+		if ( _names[k].st == NAME_FAIL ) _names[k].st = NAME_QUEUED;
+		return true;
+	}
+	for ( k = 0 ; k < HC05_MAX_NAMES && _names[k].st != NAME_FREE ; k++ ) ;
+	if ( k == HC05_MAX_NAMES ) {
+		if ( _nameNext == _nameK ) _nameNext = ( _nameNext + 1 ) % HC05_MAX_NAMES;
+		if ( _nameNext == _nameK ) return false;
+		k = _nameNext;
+		_nameNext = ( _nameNext + 1 ) % HC05_MAX_NAMES;
+	}
+	_names[k].addr = addr;
+	_names[k].name[0] = 0;
+	_names[k].st = NAME_QUEUED;
 	return true;
 }
 
+const char * HC05cBase::remoteName(const HC05Addr & addr) const {
+	int16_t k = _nameFind(addr);
+	return ( k >= 0 && _names[k].st == NAME_OK )?_names[k].name:NULL;
+}
+
+uint8_t HC05cBase::namesPending() const {
+	uint8_t n = 0;
+	for ( uint8_t k = 0 ; k < HC05_MAX_NAMES ; k++ ) {
+		if ( _names[k].st == NAME_QUEUED || _names[k].st == NAME_SENT ) n++;
+	}
+	return n;
+}
+
+int16_t HC05cBase::_nameFind(const HC05Addr & addr) const {
+	for ( uint8_t k = 0 ; k < HC05_MAX_NAMES ; k++ ) {
+		if ( _names[k].st != NAME_FREE && _names[k].addr == addr ) return k;
+	}
+	return -1;
+}
+
+/* --- Line received while an asynchronous AT command waits for its
+ * result : keep the +RNAME: answer
+ */
+void HC05cBase::_atInfo(const char * line) {
+	if ( _nameK < 0 || strncmp(line,"+RNAME:",7) != 0 ) return;
+	strncpy(_names[_nameK].name,line + 7,HC05_NAME_SZ - 1);
+	_names[_nameK].name[HC05_NAME_SZ - 1] = 0;
+}
+
+/* --- RNAME? result received (or timed out, canceled)
+ */
+void HC05cBase::_nameDone(int16_t ret) {
+	HC05Name & n = _names[_nameK];
+	n.st = ( ret == -1 && n.name[0] != 0 )?NAME_OK:NAME_FAIL;
+	_nameK = -1;
+}
+
+/* --- Decode a result line
+ * return -1 for OK, the error code for ERROR:(x), COD_FAIL for FAIL
+ * and COD_NONE when the line is not a result (+XXX: responses)
+ */
+int16_t HC05cBase::_atResult(const char * line) {
+	int16_t ret = COD_NONE;
+	if ( line[0] == 'O' && line[1] == 'K' ) ret = -1;     
+	else if ( line[0] == 'E' ) {
+		// Get Error number if line[8] = ')' then 1 digit error code, else 2 digit
+		ret = 1;
+		if ( strlen(line) >= 9 ) {
+			ret = ( line[8] != ')' )?16*(hex2dec(line[7]))+(hex2dec(line[8])):hex2dec(line[7]);
+		}
+	} else if ( line[0] == 'F' ) ret=COD_FAIL;
+	if ( ret != COD_NONE && _atLate > 0 ) {
+		// answer of a canceled command, unless it can't come anymore
+		if ( time_reached(millis(),_atLateEnd) ) _atLate = 0;
+		else {
+			_atLate--;
+			return COD_NONE;
+		}
+	}
+	if ( ret >= 0 ) hc05_log(HC05_LVL_ERROR,HC05_CAT_AT,AT_ERROR,ret);
+	HC05_METRIC(if ( ret != COD_NONE ) _metrics.result(ret,millis()));
+	return ret;
+}
 
 
 /* ======================================================================
- * HC-05 Subroutine
+ * Adaptive timeouts
  * ======================================================================
  */
 
-/* --- Search for HC05 device and baudrate 
- * (peace of code from https://github.com/jdunmire/HC05 project)
- * send AT at different baudrate and expect OK
- * it seems that testing multiple search_iter the same rate ensure to have a better detection
- * return true is found, false otherwise.
- */
-boolean HC05c::_getConnection() {
-	uint16_t numRates = sizeof(_baud_rates)/sizeof(unsigned long);
-	uint16_t recvd = 0;
-	char _buffer[128];
-	uint8_t _bufsize = sizeof(_buffer)/sizeof(char);
-	print_debug("Entering _getConnection()");
-	for(uint16_t rn = 0; rn < numRates; rn++) {
-		print_debug2(" * Trying new rate : ",_baud_rates[rn]);
-		blueToothSerial.begin(_baud_rates[rn]);
-		blueToothSerial.setTimeout(200);
-		blueToothSerial.write("AT");
-		blueToothSerial.write(CRLF);
-		delay(200);
-		recvd = blueToothSerial.readBytes(_buffer,_bufsize);
-		if (recvd > 0) {
-			print_debug("Leaving _getConnection() - Found card ");
-			return true;
-		} 
+void HC05Timeout::begin(uint32_t floor, uint32_t ceiling) {
+	_floor = floor;
+	_ceil = ceiling;
+	_srtt = 0;
+	_var = 0;
+	_n = 0;
+}
+
+/* --- A result came ms after the command
+ */
+void HC05Timeout::sample(uint32_t ms) {
+	int32_t err;
+	if ( ms > _ceil ) ms = _ceil;
+	if ( _n == 0 ) {
+		_srtt = ms << 3;
+		_var = ms << 1;             // deviation ms / 2
+	} else {
+		err = (int32_t)ms - (int32_t)( _srtt >> 3 );
+		_srtt += err;               // srtt += err / 8
+		if ( err < 0 ) err = -err;
+		_var += err - ( _var >> 2 );   // deviation += ( |err| - deviation ) / 4
 	}
-	print_debug("Leaving _getConnection() - Not Found ");
-	return false;
+	if ( _n < 0xFFFF ) _n++;
 }
 
-/* --- Force a specific state as the HC05 does not commute as I could expect
- * Once the state is forced, the device is not anymore Inquiery for State until
- * this forced state is back to ST_ERROR
+/* --- No result before the timeout : widen the margin
  */
+void HC05Timeout::expired() {
+	if ( _n == 0 ) return;
+	_var = ( _var < _ceil )?2 * _var + 4:_var;
+}
 
-void HC05c::_forceState(int state) {
-	_forced_state=state;
+uint32_t HC05Timeout::timeout() const {
+	uint32_t t;
+	if ( _n == 0 ) return _ceil;
+	t = ( _srtt >> 3 ) + _var;
+	if ( t < _floor ) return _floor;
+	return ( t > _ceil )?_ceil:t;
 }
 
-/* --- Get STATE return state code, according to:
- * -1 : ERROR            -2 : NOFORCE    -3 : SEARCH_FOR_PAIR
- *  0 : INITIALIZED      1 : READY        2 : PAIRABLE    3 : PAIRED
- *  4 : INQUIRING        5 : CONNECTING   6 : CONNECTED   7 : DISCONNECTED
- *  8 : NUKNOW
- */
-int HC05c::_getState() {
-	uint16_t recvd = 0;
-	char _buffer[128];
-	uint8_t _bufsize = sizeof(_buffer)/sizeof(char);
-	int16_t ret = ST_ERROR;
-	print_debug("Entering _getState()");
-	if (_forced_state == ST_NOFORCE ) {
-		blueToothSerial.print("AT+STATE?\r\n"); 
-		delay(200);
-		recvd = blueToothSerial.readBytes(_buffer,_bufsize);
-		if (recvd > 2 ) {
-			uint8_t i = 0;
-			while ( i < _bufsize-1 ) {
-				if ( _buffer[i] == '\n' ) { _buffer[i] = 0 ; i = _bufsize; }
-				else i++;
-			}
-			print_debug2(" * State Received :",_buffer);
-			if ( recvd > 12 ) {
-				switch (_buffer[7]) {
-					case 'R' : ret= 1; break; 
-					case 'D' : ret= 7; break;
-					case 'I' : ret= (_buffer[9]=='I')?0:4; break;
-					case 'P' : ret= (_buffer[11]=='A')?2:3; break;
-					case 'C' : if ( recvd > 16 ) ret = ( _buffer[14] == 'I')?5:6; else ret= ST_ERROR; break;    
-					default : ret = ST_ERROR; break;
-				}
-			}
-		} else ret= ST_ERROR;
-	} else	ret = _forced_state;
-	// Other cases : consider as valid command
-	print_debug2("Leaving _getState() with ret code : ",ret);
-	return ret;   
-} 
-
-
-/* --- Start Enquiring
- * start inquiring, results are read from the serial line
- * timeout is set return number of results
- */
-int HC05c::_startInq(int timeout ) {
-	uint8_t recvd = 0;
-	char _buffer[512];
-	uint8_t _bufsize = sizeof(_buffer)/sizeof(char);
-	print_debug("Entering _startInq()");
-	sprintf(_buffer,"INQM=1,4,%d",timeout); // mode rssi, 4 device max, timeout*1.28s max
-	_sendAtCmd(_buffer,true);
-	blueToothSerial.print("AT+INQ");           // start INQ    
-	blueToothSerial.print(CRLF);           // start INQ                     
-	delay(1300*timeout);
-	recvd = blueToothSerial.readBytes(_buffer,_bufsize);
-	_sendAtCmd("INQC",true);                  // Retour etat INITIALIZED
-	blueToothSerial.flush();
-	// Search for addresses in format : +INQ:aaaa:aa:aaaa,ttttt,ppppp 
-	detected_addressN = 0;
-	uint8_t i = 0, v;
-	while ( i < recvd ) {
-		if ( recvd - i > 15 ) { // do not spend search_iter looking for address is less than 15 byte
-			if ( _buffer[i] == '+'  && _buffer[i+1] == 'I' && _buffer[i+2] == 'N' && _buffer[i+3] == 'Q' && _buffer[i+4] == ':' ) {
-				// we have detected a response, search for separator (,)
-				v=i+5;
-				while ( v < recvd && _buffer[v] != ',' ) v++;
-				if ( v < recvd ) { 
-					memcpy(detected_address[detected_addressN],&_buffer[i+5], v-(i+5));  // copy address bloc
-					detected_address[detected_addressN][v-(i+5)+1]=0;                    // add end of line
-					
-					for (int k=0 ; detected_address[detected_addressN][k] != 0 ; k++ ) {	// Change ':' separator by ',' as it will be this syntaxe latter used
-						if ( detected_address[detected_addressN][k] == ':' ) detected_address[detected_addressN][k] = ',';
-					}
-					int c=0;                                                             // we should count already existing occurence of this address
-					for ( int j=0 ; j < detected_addressN ; j++ ) {
-						if ( strcmp(detected_address[j],detected_address[detected_addressN]) == 0 ) c++;
-					}
-					if ( c == 0 ) {
-						print_debug2("Address found : ",detected_address[detected_addressN]);
-						getHC05RName(detected_address[detected_addressN]);
-						detected_addressN++;
-						if (detected_addressN == 4 ) return 4;                            // No place left on table, skip
-					}
-					i=v;                                                                 // goto next
-				}
-			}
+
+/* ======================================================================
+ * Framing
+ * ======================================================================
+ */
+
+HC05Framer::HC05Framer(HC05cBase & link) : _link(link) {
+	_held = 0;
+	_crcErrors = 0;
+	_skipped = 0;
+}
+
+/* --- CRC16 CCITT (polynomial 0x1021, starting from 0xFFFF)
+ */
+uint16_t HC05Framer::crc16(uint16_t crc, uint8_t c) {
+	crc ^= (uint16_t)c << 8;
+	for ( uint8_t k = 0 ; k < 8 ; k++ ) crc = ( crc & 0x8000 )?( crc << 1 ) ^ 0x1021:crc << 1;
+	return crc;
+}
+
+uint8_t HC05Framer::encode(uint8_t * out, const uint8_t * data, uint8_t len) {
+	uint16_t crc = crc16(0xFFFF,len);
+	out[0] = HC05_FRAME_SYNC;
+	out[1] = len;
+	for ( uint8_t k = 0 ; k < len ; k++ ) {
+		out[2 + k] = data[k];
+		crc = crc16(crc,data[k]);
+	}
+	out[len + 2] = crc >> 8;
+	out[len + 3] = crc & 0xFF;
+	return len + 4;
+}
+
+/* --- Byte k of the receive buffer, from the oldest one
+ */
+uint8_t HC05Framer::_at(uint16_t k) const {
+	return _link._rx[( _link._rxTail + k ) & (RX_BUFSZ - 1)];
+}
+
+/* --- Look for a complete frame at the start of the receive buffer
+ * Bytes before a sync byte are skipped, a frame with a bad length or CRC
+ * loses its sync byte and the search goes on from the next one
+ */
+int16_t HC05Framer::recv(const uint8_t ** data) {
+	uint16_t n, crc;
+	uint8_t len, k;
+	const uint8_t * p;
+	release();
+	_link.pump();
+	for (;;) {
+		n = _link._rxHead - _link._rxTail;
+		if ( n < 2 ) return -1;
+		len = _at(1);
+		if ( _at(0) != HC05_FRAME_SYNC || len == 0 || len > HC05_FRAME_MAX ) {
+			_link.consume(1);
+			_skipped++;
+			continue;
+		}
+		if ( n < (uint16_t)len + 4 ) return -1;
+		crc = crc16(0xFFFF,len);
+		for ( k = 0 ; k < len ; k++ ) crc = crc16(crc,_at(2 + k));
+		if ( ( crc >> 8 ) != _at(len + 2) || ( crc & 0xFF ) != _at(len + 3) ) {
+			_link.consume(1);
+			_crcErrors++;
+			continue;
 		}
-		i++;
+		break;
 	}
-	print_debug2("Leaving _startInq() with ret code : ",detected_addressN);
-	return detected_addressN;   
- } 
-
-/* --- Get MRAD - Most Recent Used Address
- * return it in detected_Address[0], empty this table if not failed
- */
- boolean HC05c::getHC05Mrad() {
-	uint8_t recvd = 0;
-	char _buffer[128];
-	uint8_t _bufsize = sizeof(_buffer)/sizeof(char);
-	print_debug("Entering getHC05Mrad()");
-	blueToothSerial.print("AT+MRAD?\r\n");
-	delay(200);
-	recvd = blueToothSerial.readBytes(_buffer,_bufsize);
-	if (recvd > 6 ) {
-		uint8_t i = 0;
-		while ( i < _bufsize-1 ) {
-			if ( _buffer[i] == '\n' ) { _buffer[i] = 0 ; i = _bufsize; }
-			else i++;
+	if ( _link.peek(&p) >= (uint16_t)len + 2 ) *data = p + 2;
+	else {
+		for ( k = 0 ; k < len ; k++ ) _frame[k] = _at(2 + k);
+		*data = _frame;
+	}
+	_held = len + 4;
+	return len;
+}
+
+void HC05Framer::release() {
+	_link.consume(_held);
+	_held = 0;
+}
+
+bool HC05Framer::send(const uint8_t * data, uint8_t len) {
+	uint8_t head[2];
+	uint8_t tail[2];
+	uint16_t crc;
+	if ( len == 0 || len > HC05_FRAME_MAX ) return false;
+	if ( TX_BUFSZ - (uint16_t)( _link._txHead - _link._txTail ) < (uint16_t)len + 4 ) {
+		// no room : write what is queued first
+		if ( flush() < 0 || TX_BUFSZ - (uint16_t)( _link._txHead - _link._txTail ) < (uint16_t)len + 4 ) return false;
+	}
+	crc = crc16(0xFFFF,len);
+	for ( uint8_t k = 0 ; k < len ; k++ ) crc = crc16(crc,data[k]);
+	head[0] = HC05_FRAME_SYNC;
+	head[1] = len;
+	tail[0] = crc >> 8;
+	tail[1] = crc & 0xFF;
+	_link._txQueue(head,2);
+	_link._txQueue(data,len);
+	_link._txQueue(tail,2);
+	return true;
+}
+
+int16_t HC05Framer::flush() {
+	if ( _link.pump() < 0 ) return -1;
+	return _link.txPending();
+}
+
+
+/* ======================================================================
+ * Multi-link scheduler
+ * ======================================================================
+ */
+
+HC05Scheduler::HC05Scheduler() {
+	_n = 0;
+	_first = 0;
+}
+
+int8_t HC05Scheduler::add(HC05Link * link, uint32_t timeout) {
+	if ( _n == HC05_MAX_LINKS ) return -1;
+	_link[_n] = link;
+	_worst[_n] = 0;
+	restart(_n,timeout);
+	return _n++;
+}
+
+void HC05Scheduler::restart(uint8_t k, uint32_t timeout) {
+	_flags[k] = ( timeout > 0 )?LNK_DEADLINE:0;
+	_deadline[k] = millis() + timeout;
+}
+
+/* --- One step for every link, the first one served rotates so a link
+ * taking long steps delays each of the others by the same amount
+ * A link is connected as long as its step says so, a lost link goes back
+ * to connection steps with no deadline
+ */
+void HC05Scheduler::run(uint32_t now) {
+	for ( uint8_t i = 0 ; i < _n ; i++ ) {
+		uint8_t k = ( _first + i ) % _n;
+		uint32_t start;
+		if ( _flags[k] & LNK_EXPIRED ) continue;
+		if ( _flags[k] & LNK_UP ) {
+			if ( _link[k]->pump() < 0 ) _flags[k] = 0;     // link lost
+			continue;
 		}
-		print_debug2(" * Received :",_buffer);
-		if ( _buffer[0]=='+' && _buffer[1] == 'M' ) {
-			uint8_t v=6;
-			while ( v < recvd && _buffer[v] != 0 ) v++;
-			if ( v < recvd ) {
-				memcpy(detected_address[0],&_buffer[6], v-6);	// copy address bloc
-				detected_address[0][v-6+1]=0;					// add end of line
-				for (uint8_t k=0 ; detected_address[0][k] != 0 ; k++ )   // Change ':' separator by ',' as it will be this syntaxe latter used
-				if ( detected_address[0][k] == ':' ) detected_address[0][k] = ',';
-				detected_addressN = 1;
-				print_debug("Leaving getHC05Mrad() - true");
-				return true;
-			}        
+		if ( ( _flags[k] & LNK_DEADLINE ) && time_reached(now,_deadline[k]) ) {
+			_flags[k] = LNK_EXPIRED;
+			continue;
 		}
+		start = millis();
+		if ( _link[k]->tick(now) ) _flags[k] = LNK_UP;
+		start = millis() - start;
+		if ( start > _worst[k] ) _worst[k] = ( start > 0xFFFF )?0xFFFF:start;
 	}
-	// Other cases : consider as valid command
-	print_debug("Leaving getHC05Mrad() - false");
-	return false;
-}
-    
- 
-/* --- Get ADCN value
- * ADCN is the number of paired devices stored in the memory
- * return the number from response format : +ADCN:X where X is the value on 1 or 2 digit
- * return -1 when error
- */
-int HC05c::getHC05ADCN(){
-	uint8_t recvd = 0;
-	char _buffer[128];
-	uint8_t _bufsize = sizeof(_buffer)/sizeof(char);
-	int16_t ret = -1;
-	print_debug("Entering getHC05ADCN()");
-	blueToothSerial.print("AT+ADCN?\r\n"); 
-	delay(200);
-	recvd = blueToothSerial.readBytes(_buffer,_bufsize);
-	if (recvd > 7 ) { // test valid for 2 digit or 1 digit + \n
-		if ( _buffer[0] == '+' ) {
-			ret = _buffer[6] - '0'; 
-			if ( _buffer[7] >= '0' && _buffer[7] <= '9' ) ret = 10 * ret + _buffer[7] - '0';
+	if ( _n > 0 ) _first = ( _first + 1 ) % _n;
+}
+
+
+/* ======================================================================
+ * Bluetooth address
+ * ======================================================================
+ */
+
+/* --- Parse an address made of NAP, UAP and LAP hexadecimal values
+ * separated by ':' or ',' as 2:72:D2224 (leading zeros may be omitted)
+ * return a pointer to the first char after the address, NULL if invalid
+ */
+const char * HC05Addr::parse(const char * str) {
+	static const uint8_t digits[3] = { 4, 2, 6 };
+	uint32_t v[3];
+	for ( uint8_t f = 0 ; f < 3 ; f++ ) {
+		uint8_t n = 0;
+		v[f] = 0;
+		if ( f > 0 ) {
+			if ( *str != ':' && *str != ',' ) return NULL;
+			str++;
+		}
+		while ( isxdigit(*str) ) {
+			if ( ++n > digits[f] ) return NULL;
+			v[f] = ( v[f] << 4 ) | hex2dec(toupper(*str));
+			str++;
 		}
-		print_debug2(" * ADCN :",ret);
+		if ( n == 0 ) return NULL;
+	}
+	b[0] = v[0] >> 8;  b[1] = v[0];           // NAP
+	b[2] = v[1];                                // UAP
+	b[3] = v[2] >> 16; b[4] = v[2] >> 8; b[5] = v[2];   // LAP
+	return str;
+}
+
+/* --- Format the address as the HC05 expects it in AT commands
+ * out must hold HC05_ADDR_STRSZ chars, return out
+ */
+char * HC05Addr::format(char * out, char sep) const {
+	sprintf(out,"%X%c%X%c%lX",nap(),sep,uap(),sep,(unsigned long)lap());
+	return out;
+}
+
+bool HC05Addr::operator==(const HC05Addr & a) const {
+	return memcmp(b,a.b,sizeof(b)) == 0;
+}
+
+/* --- Hash used by HC05AddrSet, LAP is the most random part
+ */
+uint8_t HC05Addr::hash() const {
+	return b[5] ^ ( b[4] * 7 ) ^ ( b[3] * 31 ) ^ b[2];
+}
+
+
+/* ======================================================================
+ * Known devices cache
+ * ======================================================================
+ */
+
+#define KNOWN_MAGIC 0x5C
+
+HC05KnownCache::HC05KnownCache() {
+	_storage = NULL;
+	_data.n = 0;
+	_data.seq = 0;
+}
+
+/* --- Attach the storage and load the cache from it
+ * the cache is emptied when the storage content is not valid
+ */
+void HC05KnownCache::begin(HC05Storage * storage) {
+	_storage = storage;
+	if ( _storage == NULL || ! _storage->load(&_data,sizeof(_data))
+	  || _data.magic != KNOWN_MAGIC || _data.n > HC05_MAX_KNOWN || _data.sum != _checksum() ) {
+		_data.n = 0;
+		_data.seq = 0;
+	}
+}
+
+/* --- return index of addr or -1
+ */
+int16_t HC05KnownCache::find(const HC05Addr & addr) const {
+	for ( uint8_t k = 0 ; k < _data.n ; k++ ) {
+		if ( _data.dev[k].addr == addr ) return k;
+	}
+	return -1;
+}
+
+/* --- Device seen by an inquiry, update its signal level
+ * return true when the device is known
+ */
+bool HC05KnownCache::seen(const HC05Addr & addr, int16_t rssi) {
+	int16_t k = find(addr);
+	if ( k < 0 ) return false;
+	_data.dev[k].rssi = ( rssi < -128 )?-128:( rssi > 0 )?0:rssi;
+	return true;
+}
+
+/* --- Record a LINK attempt result, the cache is saved on success
+ * a new device is only added on success, replacing the lowest ranked
+ * one when the cache is full
+ */
+void HC05KnownCache::result(const HC05Addr & addr, bool ok) {
+	int16_t k = find(addr);
+	if ( k < 0 ) {
+		if ( ! ok ) return;
+		if ( _data.n < HC05_MAX_KNOWN ) k = _data.n++;
+		else k = rank(HC05_MAX_KNOWN - 1);
+		memset(&_data.dev[k],0,sizeof(HC05Known));
+		_data.dev[k].addr = addr;
+	}
+	HC05Known & d = _data.dev[k];
+	if ( d.tries == 255 ) {
+		d.tries /= 2;
+		d.oks /= 2;
 	}
-	else ret = -1;
-	// Other cases : consider as valid command
-	print_debug2("Leaving getHC05ADCN() with ret code : ",ret);
-	return ret;   
-}
- 
-/* --- Send AT Command and get Error code back
- * imediate : when true directly read result, do not wait them to come
- *            make sense when you are not waiting for a remote device answer
- *
- * Send AT command over blueToothSerial then return -1 id OK error code otherwise
- * According to Doc
- * 0 - AT CMD Error           1 - Default result      2 - PSKEY write error      3 - Too Long
- * 4 - No Dev Name            5 - Bt NAP too long     6 - BT UAP too long        7 - BT LAP too long
- * 8 - No PIO num mask        9 - No PIO Num          10 - No BT device         11 - Too lenght of device
- * 12 - No Inquire ac        13 - Too long inq ac     14 - Invalid inq ac code  15 - Passkay Lenght is 0
- * 16 - Passkey len too long 17 - Invalide modul role 18 - Invalid baud rate    19 - Invalid strop bit
- * 20 - Invalid parity bit   21 - auth dev not pair   22 - SPP not init         23 - SPP has been init
- * 24 - Invalid inq mode     25 - Too long inq search_iter   26 - No BT addresse       27 - Invalid safe mode
- * 28 - Invalid encryptmode  30 - FAIL
- */
-int HC05c::_sendAtCmd(char * atcmdstr, boolean imediate) {
-	uint8_t recvd = 0;
-	char _buffer[128];
-	uint8_t _bufsize = sizeof(_buffer)/sizeof(char);
-	int16_t ret = -1;
-	print_debug("Entering _sendAtCmd()");
-	print_debug2(" * Send : ",atcmdstr);
-	blueToothSerial.print("AT+");
-	blueToothSerial.print(atcmdstr);
-	blueToothSerial.print(CRLF); 
-	delay(200);
-	while ( ( recvd = blueToothSerial.readBytes(_buffer,_bufsize) ) == 0 && (! imediate) ) delay(100);
-#ifdef BT_DEBUG
-	if (recvd > 0 ) {
-		uint8_t i = 0;
-		while ( i < _bufsize-1 ) {
-			if ( _buffer[i] == '\n' ) { _buffer[i] = 0 ; i = _bufsize; }
-			else i++;
+	d.tries++;
+	if ( ! ok ) return;                 // kept in RAM until the next success
+	d.oks++;
+	d.last_ok = ++_data.seq;
+	if ( d.last_ok == 0 ) d.last_ok = ++_data.seq;   // 0 means never
+	if ( _storage != NULL ) {
+		_data.magic = KNOWN_MAGIC;
+		_data.sum = _checksum();
+		_storage->save(&_data,sizeof(_data));
+	}
+}
+
+/* --- return index of the device ranked at position pos (0 is the best)
+ * or -1 when there is no such device
+ */
+int16_t HC05KnownCache::rank(uint8_t pos) const {
+	if ( pos >= _data.n ) return -1;
+	// selection : the device having exactly pos better ones (ties by index)
+	for ( uint8_t k = 0 ; k < _data.n ; k++ ) {
+		int16_t sk = _score(_data.dev[k]);
+		uint8_t better = 0;
+		for ( uint8_t j = 0 ; j < _data.n ; j++ ) {
+			int16_t sj = _score(_data.dev[j]);
+			if ( sj > sk || ( sj == sk && j < k ) ) better++;
 		}
-		print_debug2(" * Received :",_buffer);
+		if ( better == pos ) return k;
+	}
+	return -1;
+}
+
+/* --- Score of a device
+ * success rate (0..100) + recency of the last success (0..48)
+ * + signal level of the last inquiry (0..50)
+ */
+int16_t HC05KnownCache::_score(const HC05Known & d) const {
+	int16_t score = ( d.tries > 0 )?(int16_t)d.oks * 100 / d.tries:0;
+	uint16_t age = _data.seq - d.last_ok;       // successful links since
+	if ( d.last_ok != 0 && age < 16 ) score += 3 * ( 16 - age );
+	if ( d.rssi != 0 ) score += ( d.rssi + 100 ) / 2;
+	return score;
+}
+
+uint8_t HC05KnownCache::_checksum() const {
+	const uint8_t * p = (const uint8_t *)&_data;
+	uint8_t sum = 0;
+	for ( uint16_t k = 0 ; k < sizeof(_data) ; k++ ) {
+		if ( p + k != &_data.sum ) sum = ( sum << 1 | sum >> 7 ) ^ p[k];
 	}
+	return sum;
+}
+
+#ifdef __AVR__
+/* --- Known devices cache stored in EEPROM from address base
+ * update() only writes the bytes that changed
+ */
+bool HC05EepromStorage::load(void * data, uint16_t len) {
+	uint8_t * p = (uint8_t *)data;
+	if ( _base + len > EEPROM.length() ) return false;
+	for ( uint16_t k = 0 ; k < len ; k++ ) p[k] = EEPROM.read(_base + k);
+	return true;
+}
+
+void HC05EepromStorage::save(const void * data, uint16_t len) {
+	const uint8_t * p = (const uint8_t *)data;
+	if ( _base + len > EEPROM.length() ) return;
+	for ( uint16_t k = 0 ; k < len ; k++ ) EEPROM.update(_base + k,p[k]);
+}
 #endif
-	if (recvd >= 2) {
-		if ( _buffer[0] == 'O' && _buffer[1] == 'K' ) ret = -1;     
-		else if ( _buffer[0] == 'E' ) {
-			// Get Error number if _buffer[8] = ')' then 1 digit error code, else 2 digit
-			if ( recvd >= 9 ) {
-				ret = ( _buffer[8] != ')' )?16*(hex2dec(_buffer[7]))+(hex2dec(_buffer[8])):hex2dec(_buffer[7]);
-				print_debug2(" * Error code : ",ret);
-			}
-		} else if ( _buffer[0] == 'F' ) {
-			print_debug(" * Error code : FAIL");
-			ret=COD_FAIL;
-		}
+
+
+#if HC05_LOG_LEVEL > 0
+/* ======================================================================
+ * Deferred log
+ * ======================================================================
+ */
+
+HC05Log::Rec HC05Log::_rec[HC05_LOG_SZ];
+uint8_t HC05Log::_head = 0;
+uint8_t HC05Log::_n = 0;
+uint16_t HC05Log::_lost = 0;
+
+/* --- Queue a record - not blocking operation
+ */
+void HC05Log::put(uint8_t id, int32_t value) {
+	if ( _n == HC05_LOG_SZ ) {
+		if ( _lost < 0xFFFF ) _lost++;
+		return;
 	}
-	// Other cases : consider as valid command
-	print_debug("Leaving _sendAtCmd()");
-	return ret;  
-}
-
-
-/* --- Get RName - get remote device name (mostly for debugging purpose in my case
- * Print name on debugging flow
- * Remote address is transmitted with ':' separator, it is converted to ',' in the function
- * AT+RNAME?34C0,59,F191D5
- */
-void HC05c::getHC05RName(char * raddr) {
-#ifdef BT_DEBUG
-	uint8_t recvd = 0;
-	char _buffer[128];
-	uint8_t _bufsize = sizeof(_buffer)/sizeof(char);
-	int16_t ret = -1;
-	print_debug("Entering getHC05RName()");
-	print_debug2(" * Request For : ",raddr);
-	blueToothSerial.print("AT+RNAME?");
-	blueToothSerial.print(raddr); // why?
-	blueToothSerial.print(CRLF); 
-	delay(5000);
-	recvd = blueToothSerial.readBytes(_buffer,_bufsize);
-	if (recvd > 0 ) {
-		int i = 0;
-		while ( i < _bufsize-1 ) {
-			if ( _buffer[i] == '\n' ) { _buffer[i] = 0 ; i = _bufsize; }
-			else i++;
+	Rec & r = _rec[( _head + _n ) % HC05_LOG_SZ];
+	r.id = id;
+	r.ms = millis();
+	r.value = value;
+	_n++;
+}
+
+uint8_t HC05Log::pending() {
+	return _n;
+}
+
+/* --- Write the oldest records, 9 bytes each
+ */
+uint8_t HC05Log::drain(Print & out, uint8_t max) {
+	uint8_t done = 0;
+	uint8_t buf[9];
+	while ( done < max && _n > 0 ) {
+		const Rec & r = _rec[_head];
+		buf[0] = r.id;
+		for ( uint8_t k = 0 ; k < 4 ; k++ ) {
+			buf[1 + k] = r.ms >> ( 8 * k );
+			buf[5 + k] = (uint32_t)r.value >> ( 8 * k );
 		}
-		print_debug2(" * Received :",_buffer);
+		out.write(buf,sizeof(buf));
+		_head = ( _head + 1 ) % HC05_LOG_SZ;
+		_n--;
+		done++;
 	}
-	// Other cases : consider as valid command
-	print_debug("Leaving getHC05RName()");
+	return done;
+}
+
+/* --- Pack the first 4 chars of s, first char in the low byte
+ */
+int32_t HC05Log::tag(const char * s) {
+	uint32_t v = 0;
+	for ( uint8_t k = 0 ; k < 4 && s[k] != 0 ; k++ ) v |= (uint32_t)(uint8_t)s[k] << ( 8 * k );
+	return v;
+}
 #endif
+
+
+#ifdef HC05_METRICS
+/* ======================================================================
+ * Metrics
+ * ======================================================================
+ */
+
+/* --- Record a state change (forced state first, as _getState() does)
+ */
+void HC05cBase::_noteState() {
+	_metrics.state(( _forced_state != ST_NOFORCE )?_forced_state:_state,millis());
 }
 
+HC05Metrics::HC05Metrics() {
+	reset();
+}
+
+void HC05Metrics::reset() {
+	memset(_cmd,0,sizeof(_cmd));
+	for ( uint8_t k = 0 ; k < HC05_CMD_COUNT ; k++ ) _cmd[k].min_ms = 0xFFFF;
+	memset(_codes,0,sizeof(_codes));
+	memset(_states,0,sizeof(_states));
+	_in = 0;
+	_out = 0;
+	_last = ST_NOFORCE;
+	_evN = 0;
+	_pn = 0;
+}
 
+const char * HC05Metrics::commandName(uint8_t cls) {
+	return ( cls < HC05_CMD_COUNT )?CMD_NAMES[cls]:"";
+}
+
+/* --- A command has been sent, its result is expected after the ones
+ * already waiting. When too many are waiting the oldest one is
+ * considered lost
+ */
+void HC05Metrics::sent(uint8_t cls, uint32_t now) {
+	if ( _pn == sizeof(_pcls) ) result(COD_TIMEOUT,now);
+	_pcls[_pn] = cls;
+	_pms[_pn] = now;
+	_pn++;
+}
+
+/* --- Result of the oldest command waiting
+ * code : -1 for OK, error code, COD_FAIL or COD_TIMEOUT
+ */
+void HC05Metrics::result(int16_t code, uint32_t now) {
+	if ( _pn == 0 ) return;                    // unsolicited
+	HC05CmdStats & st = _cmd[_pcls[0]];
+	uint32_t ms = now - _pms[0];
+	uint8_t bin = 0;
+	st.count++;
+	if ( code == COD_TIMEOUT ) st.timeouts++;
+	else {
+		if ( code >= 0 ) st.errors++;
+		if ( ms > 0xFFFF ) ms = 0xFFFF;
+		if ( ms < st.min_ms ) st.min_ms = ms;
+		if ( ms > st.max_ms ) st.max_ms = ms;
+		while ( ms > 0 && bin < HC05_HIST_BINS - 1 ) {
+			ms >>= 1;
+			bin++;
+		}
+		st.hist[bin]++;
+	}
+	if ( code >= 0 ) {
+		_codes[code & 31]++;
+		_event(HC05_EV_ERROR,_pcls[0],code,now);
+	}
+	_pn--;
+	memmove(_pcls,_pcls + 1,_pn);
+	memmove(_pms,_pms + 1,_pn * sizeof(_pms[0]));
+}
+
+/* --- State seen by HC05c, counted when it differs from the last one
+ */
+void HC05Metrics::state(int16_t st, uint32_t now) {
+	if ( st == _last ) return;
+	_states[( st + 3 ) & 15]++;
+	_event(HC05_EV_STATE,_last,st,now);
+	_last = st;
+}
+
+void HC05Metrics::_event(uint8_t type, int8_t a, int16_t b, uint32_t now) {
+	HC05Event & e = _ev[_evN & ( HC05_EVENTS - 1 )];
+	e.ms = now;
+	e.type = type;
+	e.a = a;
+	e.b = b;
+	if ( ++_evN == 0 ) _evN = HC05_EVENTS;     // keep events() full after wrap
+}
+#endif
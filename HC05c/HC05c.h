@@ -2,8 +2,6 @@
 #ifndef _HC05C_H_
 #define _HC05C_H_
 
-#define BT_DEBUG
-
 /* ======================================================================
  * Configuration
  * ======================================================================
@@ -18,6 +16,101 @@
 #define MAX_MASTER_TIME   25        // Wait as a master for MAX_MASTER_TIME * 1.28s (max is 48)                                  
 #endif
 
+#ifndef RESET_TIME
+#define RESET_TIME        5000      // max ms to wait for the module to reboot after AT+RESET
+#endif
+
+#ifndef INIT_TIME
+#define INIT_TIME         2000      // max ms to wait for AT+INIT result (SPP ready)
+#endif
+
+#ifndef IDLE_TIME
+#define IDLE_TIME         5000      // ms to stay idle when initialized with nothing to pair
+#endif
+
+#ifndef RETRY_TIME
+#define RETRY_TIME        1000      // ms before polling again a transient state
+#endif
+
+#ifndef PAIR_TIMEOUT
+#define PAIR_TIMEOUT      25000     // ms to wait for AT+PAIR result (PAIR is sent with a 20s limit)
+#endif
+
+#ifndef AT_TIMEOUT
+#define AT_TIMEOUT        1000      // max ms to wait for the answer of a local AT command
+#endif
+
+// -- Adaptive timeouts : RESET, INIT and local AT commands wait for the
+// latency observed so far plus a margin, kept between a floor and the
+// ceiling above
+#ifndef AT_TIMEOUT_MIN
+#define AT_TIMEOUT_MIN    200       // min ms to wait for the answer of a local AT command
+#endif
+
+#ifndef RESET_TIME_MIN
+#define RESET_TIME_MIN    500       // min ms to wait for the module to reboot
+#endif
+
+#ifndef INIT_TIME_MIN
+#define INIT_TIME_MIN     100       // min ms to wait for AT+INIT result
+#endif
+
+#ifndef AT_PIPELINE
+#define AT_PIPELINE       4         // AT commands sent ahead of their result in a batch
+#endif
+
+#ifndef AT_PROBE_TIMEOUT
+#define AT_PROBE_TIMEOUT  200       // ms to wait for OK when probing a baudrate
+#endif
+
+#ifndef HC05_PROBE_TIME
+#define HC05_PROBE_TIME   0         // max ms to find the module baudrate, all rates included
+#endif                              // 0 : AT_PROBE_TIMEOUT for each rate of the table
+
+#ifndef HC05_BAUD_RATES
+#define HC05_BAUD_RATES   38400, 115200, 9600, 19200, 57600   // probe order after the last rate found
+#endif
+
+#ifndef RNAME_TIMEOUT
+#define RNAME_TIMEOUT     5000      // ms to wait for a remote device name (requestName)
+#endif
+
+#ifndef STATE_STALE_TIME
+#define STATE_STALE_TIME  1000      // ms a state read from the module is trusted without asking again
+#endif
+
+#ifndef LINK_TIMEOUT
+#define LINK_TIMEOUT      20000     // ms to wait for AT+LINK result
+#endif
+
+// -- Recovery after a link loss : LINK to the last peer again, then INIT
+// and LINK, then a full reset
+#ifndef HC05_RELINK_TRIES
+#define HC05_RELINK_TRIES 3         // LINK attempts before going to INIT
+#endif
+
+#ifndef HC05_RELINK_DELAY
+#define HC05_RELINK_DELAY 250       // ms before the second LINK attempt, doubled for each next one
+#endif
+
+// -- Logging : level kept at compile time, 0 compiles every log away
+// 1 errors, 2 connection steps, 3 AT traffic. BT_DEBUG selects level 3
+#ifndef HC05_LOG_LEVEL
+#ifdef BT_DEBUG
+#define HC05_LOG_LEVEL    3
+#else
+#define HC05_LOG_LEVEL    0
+#endif
+#endif
+
+#ifndef HC05_LOG_CATS
+#define HC05_LOG_CATS     0xFF      // categories kept, HC05_CAT_xxx ored
+#endif
+
+#ifndef HC05_LOG_SZ
+#define HC05_LOG_SZ       32        // records waiting for HC05Log::drain()
+#endif
+
 // -- Serial port used for hc05 communication
 #ifndef blueToothSerial
 #define blueToothSerial Serial1
@@ -28,14 +121,62 @@
  * Helper and constants
  * ======================================================================
  */
-#ifdef BT_DEBUG
-  #define print_debug(x) Serial.print("Debug :");Serial.println(x);
-  #define print_debug2(x,y) Serial.print("Debug :");Serial.print(x);Serial.println(y);
-#else 
-  #define print_debug(x) 
-  #define print_debug2(x,y) 
+#define HC05_LVL_ERROR  1
+#define HC05_LVL_STEP   2
+#define HC05_LVL_AT     3
+
+#define HC05_CAT_SETUP  0x01    // setupConnection and baudrate probe
+#define HC05_CAT_STATE  0x02    // connection state machine
+#define HC05_CAT_INQ    0x04    // inquiry, paired devices
+#define HC05_CAT_AT     0x08    // AT commands and results
+
+// -- Log messages : id and printf format of the value (a long, or 4 chars
+// for %.4s). The text is not part of the library, it is only needed to
+// decode the drained records.
+#define HC05_LOG_MESSAGES(M) \
+	M(SETUP_FAIL,   "setupConnection failed at step %ld") \
+	M(SETUP_DONE,   "setupConnection done, %ld settings written") \
+	M(PROBE_RATE,   "probing %ld bauds") \
+	M(PROBE_FOUND,  "module found at %ld bauds") \
+	M(PROBE_NONE,   "module not found") \
+	M(STATE,        "state %ld") \
+	M(STATE_READ,   "STATE? read %ld") \
+	M(SLAVE_WAIT,   "waiting for pairing as a slave") \
+	M(INQ_INVALID,  "inquiring - invalid state, reset") \
+	M(PAIRED,       "paired to a device, linking") \
+	M(DISC,         "disconnection detected") \
+	M(RECOVER,      "link recovery, tier %ld") \
+	M(RECOVERED,    "link recovered in %ld ms") \
+	M(MASTER,       "pairing as a master") \
+	M(INQ_START,    "inquiry started") \
+	M(INQ_FOUND,    "device found, LAP %lX") \
+	M(INQ_END,      "inquiry done, %ld devices") \
+	M(MRAD,         "most recent used address read : %ld") \
+	M(ADCN,         "%ld paired devices") \
+	M(RNAME,        "RNAME? of LAP %lX sent") \
+	M(AT_SEND,      "AT+%.4s sent") \
+	M(AT_ERROR,     "AT error code %ld") \
+	M(AT_TIMEOUT,   "AT timeout") \
+	M(AT_BATCH,     "AT batch done, %ld failed")
+
+#define HC05_LOG_ID(id, fmt) HC05_LG_##id,
+enum { HC05_LOG_MESSAGES(HC05_LOG_ID) HC05_LG_COUNT };
+#undef HC05_LOG_ID
+
+// -- hc05_log(level, category, id, value) queues a record, the value is not
+// evaluated when the level or the category is not kept
+#if HC05_LOG_LEVEL > 0
+  #define hc05_log(lvl,cat,id,v) do { if ( (lvl) <= HC05_LOG_LEVEL && ( (cat) & HC05_LOG_CATS ) ) HC05Log::put(HC05_LG_##id,(int32_t)(v)); } while (0)
+#else
+  #define hc05_log(lvl,cat,id,v) do { } while (0)
+#endif
+#ifdef HC05_METRICS
+  #define HC05_METRIC(x) x
+#else
+  #define HC05_METRIC(x)
 #endif
 #define hex2dec(x) ((x>'9')?10+x-'A':x-'0')
+#define time_reached(now,t) ((int32_t)((now)-(t)) >= 0)
 
 // -- HC05 States
 #define ST_INITIALIZED 0
@@ -48,46 +189,786 @@
 #define ST_NOFORCE -2
 #define ST_SEARCH_FOR_PAIR  -3
 
+// -- Connection sub-states, tick() waits on a deadline in each of them
+#define SS_NONE     0   // dispatch on the HC05 state
+#define SS_SLEEP    1   // idle until deadline
+#define SS_RESET    2   // RESET sent, module is rebooting
+#define SS_INIT     3   // INIT sent, SPP is starting
+#define SS_SLAVE    4   // waiting to be paired as a slave
+#define SS_INQ      5   // inquiring as a master
+#define SS_SELECT   6   // walking through detected devices
+#define SS_PAIR     7   // PAIR sent, waiting for result
+#define SS_LINK     8   // LINK sent, waiting for result
+#define SS_KNOWN    9   // walking through known devices
+#define SS_RECOVER  10  // link lost, next recovery attempt at deadline
+
+// -- Master passes over the detected devices
+#define PASS_LINK   0   // link to devices already paired
+#define PASS_PAIR   1   // pair then link to new devices
+#define PASS_MRAD   2   // link to the most recent used address
+#define PASS_KNOWN  3   // link to the known devices cache
+#define PASS_RECOVER 4  // link to the last peer after a link loss
+
+// -- Recovery tiers
+#define HC05_REC_LINK     0   // LINK to the last peer, with backoff
+#define HC05_REC_INIT     1   // INIT then LINK
+#define HC05_REC_RESET    2   // RESET and the whole connection process
+#define HC05_REC_TIERS    3
+#define HC05_REC_NONE     0xFF
+
 // -- Internal
+#define COD_SPP_INIT 23 // ERROR:(17), INIT when SPP is already initialized
+#define COD_CANCEL 29  // asynchronous command canceled
 #define COD_FAIL  30
+#define COD_TIMEOUT 31  // no result received before the deadline
+#define COD_BUSY  32    // not sent, an asynchronous command is waiting for its result
+#define COD_NONE  -2    // line is not a command result
 #define BUFSZ 50
+#define AT_RESULT_SZ 11 // longest result line (ERROR:(1F)) and its end
+
+#ifndef HC05_MAX_DEVICES
+#define HC05_MAX_DEVICES 8   // devices kept from an inquiry
+#endif
+
+#ifndef HC05_MAX_KNOWN
+#define HC05_MAX_KNOWN 4     // devices kept in the known devices cache
+#endif
+
+#ifndef HC05_MAX_NAMES
+#define HC05_MAX_NAMES 4     // remote device names kept by requestName()
+#endif
+
+#ifndef HC05_NAME_SZ
+#define HC05_NAME_SZ 16      // remote device name, ending 0 included (longer ones are cut)
+#endif
+
+#ifndef HC05_MAX_LINKS
+#define HC05_MAX_LINKS 4     // links driven by one HC05Scheduler
+#endif
+
+#ifndef HC05_SCRATCH_SZ
+#define HC05_SCRATCH_SZ 128  // AT commands being built, then the last BUFSZ bytes for the answer
+#endif
+#if HC05_SCRATCH_SZ < 2 * BUFSZ
+#error "HC05_SCRATCH_SZ must be at least 2 * BUFSZ"
+#endif
+
+#ifndef RX_BUFSZ
+#define RX_BUFSZ 64     // receive buffer, must be a power of 2
+#endif
+#if ( RX_BUFSZ & ( RX_BUFSZ - 1 ) ) != 0
+#error "RX_BUFSZ must be a power of 2"
+#endif
+
+#ifndef HC05_HOLD_GAP
+#define HC05_HOLD_GAP 2000   // us without bytes giving a held back start of "+DISC:" as data
+#endif
+
+#ifndef TX_BUFSZ
+#define TX_BUFSZ 64     // transmit buffer, must be a power of 2
+#endif
+#if ( TX_BUFSZ & ( TX_BUFSZ - 1 ) ) != 0
+#error "TX_BUFSZ must be a power of 2"
+#endif
+
+#ifndef HC05_FRAME_MAX
+#define HC05_FRAME_MAX 32    // largest HC05Framer payload, a whole frame must fit in RX_BUFSZ and TX_BUFSZ
+#endif
+#if HC05_FRAME_MAX > 255 || HC05_FRAME_MAX + 4 > RX_BUFSZ || HC05_FRAME_MAX + 4 > TX_BUFSZ
+#error "HC05_FRAME_MAX + 4 must fit in RX_BUFSZ and TX_BUFSZ, 255 max"
+#endif
+#define HC05_FRAME_SYNC 0xA5 // first byte of a frame
+
+#ifndef HC05_CAP_CHUNK
+#define HC05_CAP_CHUNK 16    // bytes gathered in one capture record, 64 max
+#endif
+#if HC05_CAP_CHUNK < 1 || HC05_CAP_CHUNK > 64
+#error "HC05_CAP_CHUNK must be between 1 and 64"
+#endif
+#ifndef HC05_CAP_GAP
+#define HC05_CAP_GAP 1000    // us without bytes ending a capture record
+#endif
+#define HC05_CAP_VERSION 1
+#define HC05_CAP_RX     0    // bytes read from the module
+#define HC05_CAP_TX     1    // bytes written to the module
+#define HC05_CAP_BEGIN  2    // port started, baudrate on 4 bytes little endian
+#define HC05_CAP_MARK   3    // phase mark, 1 byte id
 
  
-class HC05c
+#if HC05_LOG_LEVEL > 0
+// -- Deferred log : records are queued in RAM by hc05_log() and written
+// later as 9 bytes : id, millis() and value, both little endian.
+// When the queue is full, new records are dropped and counted.
+class HC05Log
 {
 	public:
-		HC05c();
+		static void		put(uint8_t id, int32_t value);
+		static uint8_t	pending();
+		static uint16_t	lost() { return _lost; }
+		// write at most max records to out, return the number written
+		static uint8_t	drain(Print & out, uint8_t max);
+		// first 4 chars of s as a value, for %.4s messages
+		static int32_t	tag(const char * s);
+	private:
+		struct Rec {
+			uint8_t		id;
+			uint32_t	ms;
+			int32_t		value;
+		};
+		static Rec		_rec[HC05_LOG_SZ];
+		static uint8_t	_head;
+		static uint8_t	_n;
+		static uint16_t	_lost;
+};
+#endif
+
+// -- Module configuration applied by setupConnection()
+struct HC05Config {
+	const char *	name;		// BT displayed name (10 chars max)
+	const char *	passwd;		// BT password (10 chars max)
+	uint32_t		uart;		// serial over BT rate + Arduino rate (next restart)
+	const char *	iac;		// inquiry access code
+	uint8_t			cmode;		// 0 : connect to bind address, 1 : to any address
+};
+
+// -- Bluetooth device address, stored as 6 bytes : NAP (16 bits), UAP (8 bits)
+// and LAP (24 bits). Text form is only used at the AT command boundary.
+#define HC05_ADDR_STRSZ 15
+
+struct HC05Addr {
+	uint8_t		b[6];
+	uint16_t	nap() const { return ( (uint16_t)b[0] << 8 ) | b[1]; }
+	uint8_t		uap() const { return b[2]; }
+	uint32_t	lap() const { return ( (uint32_t)b[3] << 16 ) | ( (uint16_t)b[4] << 8 ) | b[5]; }
+	const char *	parse(const char * str);
+	char *		format(char * out, char sep) const;
+	bool		operator==(const HC05Addr & a) const;
+	uint8_t		hash() const;
+};
+
+// -- Set of up to N addresses, kept in insertion order. Lookup goes
+// through an open addressed table of 2N slots holding index + 1.
+template<uint8_t N> class HC05AddrSet
+{
+	public:
+		HC05AddrSet() { clear(); }
+		void	clear() { _n = 0; memset(_slot,0,sizeof(_slot)); }
+		uint8_t	size() const { return _n; }
+		bool	full() const { return _n == N; }
+		const HC05Addr & operator[](uint8_t i) const { return _addr[i]; }
+		// return index of addr or -1
+		int16_t	find(const HC05Addr & addr) const {
+			uint8_t s = addr.hash() % SLOTS;
+			while ( _slot[s] != 0 ) {
+				if ( _addr[_slot[s] - 1] == addr ) return _slot[s] - 1;
+				s = ( s + 1 ) % SLOTS;
+			}
+			return -1;
+		}
+		// return true when addr is new and has been added
+		bool	add(const HC05Addr & addr) {
+			uint8_t s = addr.hash() % SLOTS;
+			if ( full() ) return false;
+			while ( _slot[s] != 0 ) {
+				if ( _addr[_slot[s] - 1] == addr ) return false;
+				s = ( s + 1 ) % SLOTS;
+			}
+			_addr[_n] = addr;
+			_slot[s] = ++_n;
+			return true;
+		}
+	private:
+		enum { SLOTS = 2 * N };
+		HC05Addr	_addr[N];
+		uint8_t		_slot[SLOTS];
+		uint8_t		_n;
+};
+
+// -- Remote device name, resolved on request
+#define NAME_FREE   0
+#define NAME_QUEUED 1   // RNAME? to be sent
+#define NAME_SENT   2   // RNAME? sent, waiting for +RNAME:
+#define NAME_OK     3
+#define NAME_FAIL   4   // no answer, device out of range
+
+struct HC05Name {
+	HC05Addr	addr;
+	uint8_t		st;			// NAME_xxx
+	char		name[HC05_NAME_SZ];
+};
+
+// -- Known device statistics
+struct HC05Known {
+	HC05Addr	addr;
+	int8_t		rssi;		// last signal level seen by an inquiry, 0 unknown
+	uint16_t	last_ok;	// link sequence number of the last success, 0 never
+	uint8_t		tries;		// LINK attempts
+	uint8_t		oks;		// successful LINK
+};
+
+// -- Persistent storage of the known devices cache (EEPROM on AVR,
+// anything implementing load / save elsewhere)
+class HC05Storage
+{
+	public:
+		virtual ~HC05Storage() {}
+		virtual bool	load(void * data, uint16_t len) = 0;
+		virtual void	save(const void * data, uint16_t len) = 0;
+};
+
+#ifdef __AVR__
+class HC05EepromStorage : public HC05Storage
+{
+	public:
+		HC05EepromStorage(uint16_t base) : _base(base) {}
+		bool	load(void * data, uint16_t len);
+		void	save(const void * data, uint16_t len);
+	private:
+		uint16_t	_base;
+};
+#endif
+
+// -- Devices successfully linked in the past, ranked by success rate,
+// recency of the last success and signal level. Saved after each successful
+// link only : failures are counted in RAM and saved with the next success,
+// so a peer out of range does not wear the storage out.
+// millis() restarts at boot so recency is counted in successful links.
+class HC05KnownCache
+{
+	public:
+		HC05KnownCache();
+		void		begin(HC05Storage * storage);
+		uint8_t		size() const { return _data.n; }
+		const HC05Known &	get(uint8_t k) const { return _data.dev[k]; }
+		int16_t		find(const HC05Addr & addr) const;
+		int16_t		rank(uint8_t pos) const;
+		bool		seen(const HC05Addr & addr, int16_t rssi);
+		void		result(const HC05Addr & addr, bool ok);
+	private:
+		int16_t		_score(const HC05Known &) const;
+		uint8_t		_checksum() const;
+		HC05Storage *	_storage;
+		struct {
+			uint8_t		magic;
+			uint8_t		n;
+			uint16_t	seq;		// successful links counter
+			HC05Known	dev[HC05_MAX_KNOWN];
+			uint8_t		sum;
+		} _data;
+};
+
+#ifdef HC05_METRICS
+// -- AT command classes followed by the metrics
+#define HC05_CMD_AT       0   // baudrate probe / ready check
+#define HC05_CMD_STATE    1
+#define HC05_CMD_ADCN     2
+#define HC05_CMD_MRAD     3
+#define HC05_CMD_RESET    4
+#define HC05_CMD_INIT     5
+#define HC05_CMD_INQ      6
+#define HC05_CMD_INQC     7
+#define HC05_CMD_FSAD     8
+#define HC05_CMD_PAIR     9
+#define HC05_CMD_LINK     10
+#define HC05_CMD_RNAME    11
+#define HC05_CMD_OTHER    12  // settings and anything else
+#define HC05_CMD_COUNT    13
+
+#ifndef HC05_HIST_BINS
+#define HC05_HIST_BINS    16  // latency bin k counts [2^(k-1),2^k[ ms, bin 0 is < 1ms
+#endif
+
+#ifndef HC05_EVENTS
+#define HC05_EVENTS       16  // event ring size, must be a power of 2
+#endif
+#if ( HC05_EVENTS & ( HC05_EVENTS - 1 ) ) != 0
+#error "HC05_EVENTS must be a power of 2"
+#endif
+
+#define HC05_EV_STATE     0   // a : previous state, b : new state
+#define HC05_EV_ERROR     1   // a : command class, b : error code (COD_TIMEOUT...)
+
+// -- Statistics of one AT command class
+struct HC05CmdStats {
+	uint16_t	count;		// results received or timed out
+	uint16_t	errors;		// ERROR:(x) and FAIL results
+	uint16_t	timeouts;
+	uint16_t	min_ms;		// latency of the answered commands
+	uint16_t	max_ms;
+	uint16_t	hist[HC05_HIST_BINS];
+};
+
+struct HC05Event {
+	uint32_t	ms;
+	uint8_t		type;		// HC05_EV_xxx
+	int8_t		a;
+	int16_t		b;
+};
+
+// -- Counters updated by HC05c when built with HC05_METRICS. Results are
+// matched to the commands waiting for one in order, as the module answers.
+// Reading them never does any serial traffic.
+class HC05Metrics
+{
+	public:
+		HC05Metrics();
+		void		reset();
+		const HC05CmdStats &	command(uint8_t cls) const { return _cmd[cls]; }
+		static const char *	commandName(uint8_t cls);
+		static uint8_t	classOf(const char * atcmdstr);
+		uint16_t	errorCount(uint8_t code) const { return _codes[code & 31]; }
+		// number of transitions to state st (ST_xxx)
+		uint16_t	stateCount(int16_t st) const { return _states[( st + 3 ) & 15]; }
+		uint32_t	bytesIn() const { return _in; }
+		uint32_t	bytesOut() const { return _out; }
+		// events kept in the ring, event(0) is the most recent one
+		uint8_t		events() const { return ( _evN < HC05_EVENTS )?_evN:HC05_EVENTS; }
+		const HC05Event &	event(uint8_t age) const { return _ev[( _evN - 1 - age ) & ( HC05_EVENTS - 1 )]; }
+		// -- updated by HC05c
+		void		sent(uint8_t cls, uint32_t now);
+		void		result(int16_t code, uint32_t now);
+		void		state(int16_t st, uint32_t now);
+		void		moved(uint16_t in, uint16_t out) { _in += in; _out += out; }
+	private:
+		void		_event(uint8_t type, int8_t a, int16_t b, uint32_t now);
+		HC05CmdStats	_cmd[HC05_CMD_COUNT];
+		uint16_t	_codes[32];
+		uint16_t	_states[16];
+		uint32_t	_in;
+		uint32_t	_out;
+		int16_t		_last;				// last state seen
+		HC05Event	_ev[HC05_EVENTS];
+		uint16_t	_evN;				// events recorded, free running
+		// commands waiting for their result
+		uint8_t		_pcls[AT_PIPELINE + 2];
+		uint32_t	_pms[AT_PIPELINE + 2];
+		uint8_t		_pn;
+};
+#endif
+
+// -- Timeout classes, each one has its own latency estimate
+#define HC05_TO_AT        0   // local AT command answer
+#define HC05_TO_RESET     1   // RESET until the module answers AT again
+#define HC05_TO_INIT      2   // INIT until its result
+#define HC05_TO_COUNT     3
+#define HC05_TO_NONE      0xFF
+
+// -- Latency estimate of a timeout class : smoothed latency and mean
+// deviation, updated as TCP does for its retransmission timeout. The
+// timeout is srtt + 4 * deviation within [floor, ceiling], the ceiling
+// until the first sample. A timeout doubles the deviation.
+class HC05Timeout
+{
+	public:
+		void		begin(uint32_t floor, uint32_t ceiling);
+		void		sample(uint32_t ms);
+		void		expired();
+		uint32_t	timeout() const;
+		uint32_t	srtt() const { return _srtt >> 3; }
+		uint16_t	samples() const { return _n; }
+	private:
+		uint32_t	_floor;
+		uint32_t	_ceil;
+		uint32_t	_srtt;		// x8
+		uint32_t	_var;		// x4
+		uint16_t	_n;
+};
+
+// -- Link recoveries : time spent in each tier and how they ended
+struct HC05Recovery {
+	uint32_t	ms[HC05_REC_TIERS];		// time spent in the tier, all recoveries
+	uint16_t	runs[HC05_REC_TIERS];	// recoveries that went through the tier
+	uint16_t	ok[HC05_REC_TIERS];		// recoveries ended by the tier
+	uint32_t	lastMs;					// duration of the last recovery
+};
+
+// -- Called for each device found by an inquiry (address, class of device,
+// rssi), return true to stop the inquiry
+typedef bool (*HC05InqCallback)(const HC05Addr & addr, uint32_t cod, int16_t rssi);
+
+// -- What HC05Scheduler drives : a connection moved forward by steps and
+// data pumped between the serial line and the buffers
+class HC05Link
+{
+	public:
+		virtual ~HC05Link() {}
+		// one connection step - not blocking operation, true once connected
+		virtual bool		tick(uint32_t now) = 0;
+		// move pending data once connected, return the number of bytes moved
+		// or -1 when not connected
+		virtual int16_t		pump() = 0;
+};
+
+// -- Completion of an asynchronous AT command : code is -1 for OK, the
+// error code, COD_FAIL, COD_TIMEOUT or COD_CANCEL
+typedef void (*HC05AtCallback)(int16_t code, void * ctx);
+
+// -- Connection state, buffers and the parts of HC05c that do not use the
+// serial port. Implemented in HC05c.cpp
+class HC05cBase : public HC05Link
+{
+	friend class HC05Framer;
+	public:
+		HC05cBase();
+		// Zero-copy access to the receive buffer : return the number of
+		// contiguous bytes at *data, release them with consume()
+		uint16_t	peek(const uint8_t **);
+		void	consume(uint16_t);
+		// Number of bytes not yet written to the serial line
+		uint16_t	txPending();
+		// Follow the connection with the HC05 STATE pin, -1 to disable
+		void	setStatePin(int8_t pin);
+		// Follow the devices found when inquiring as a master
+		void	onInquiry(HC05InqCallback cb);
+		// Link to known devices before any inquiry
+		void	setKnownCache(HC05KnownCache * cache);
+		// Order in which the module baudrate is probed (HC05_BAUD_RATES by
+		// default), rates must stay valid
+		void	setBaudRates(const uint32_t * rates, uint8_t n);
+		// Keep the last baudrate found there, it is probed first next time
+		void	setBaudStorage(HC05Storage * storage);
+		// Rate the module answered at, 0 when unknown
+		uint32_t	baudRate() const { return _baud; }
+		// An asynchronous AT command is waiting for its result
+		bool	atBusy() const { return _atBusy; }
+		// Ask for the name of a remote device, it is resolved by tick()
+		// between two connection steps. return false when the table is full
+		bool	requestName(const HC05Addr & addr);
+		// Name of addr once resolved, NULL until then or when it failed
+		const char *	remoteName(const HC05Addr & addr) const;
+		// Names requested and not resolved yet
+		uint8_t	namesPending() const;
+		// Link recoveries after +DISC
+		const HC05Recovery &	recovery() const { return _rec; }
+		// Latency estimate and current timeout of a class (HC05_TO_xxx)
+		const HC05Timeout &	timeout(uint8_t cls) const { return _to[cls]; }
+		// Stop waiting for the asynchronous AT command, the callback gets
+		// COD_CANCEL. The answer the module still owes is dropped when it
+		// comes before the command deadline, setupConnection() waits for it
+		void	atCancel();
+#ifdef HC05_METRICS
+		// Latency, error and state counters - not blocking operation
+		const HC05Metrics &	metrics() const { return _metrics; }
+		void	resetMetrics() { _metrics.reset(); }
+#endif
+	protected:
+		static const char	DEFAULT_PASSWORD[];
+		static const char	BT_RESET[];
+		static const char	BT_FSAD[];
+		static const char	BT_INIT[];
+		static const char	CRLF[];
+		static const char	BT_DISC[7];		// +DISC:
+		void		_forceState(int16_t);
+		int16_t		_cachedState();
+		void		_setDisconnected();
+		size_t		_txQueue(const uint8_t *, size_t);
+		bool		_inqLine(const char *);
+		void		_mradFailed(uint32_t);
+		void		_wait(uint8_t, uint32_t);
+		int16_t		_atResult(const char *);
+		char *		_addrCmd(char *, const char *, const HC05Addr &);
+		void		_atDone(int16_t);
+		void		_baudFound(uint32_t);
+		void		_atInfo(const char *);
+		int16_t		_nameFind(const HC05Addr &) const;
+		void		_nameDone(int16_t);
+		void		_recoverStart(uint32_t);
+		void		_recoverNext(uint32_t);
+		void		_recoverEnd(uint32_t);
+		// answer part of the scratch arena, BUFSZ bytes
+		char *		_atResp() { return &_scratch[HC05_SCRATCH_SZ - BUFSZ]; }
+		// line received last, in the answer part
+		char *		_line() { return _atResp() + _lineAt; }
+#ifdef HC05_METRICS
+		void		_noteState();
+		HC05Metrics	_metrics;
+#endif
+		// list of devices detected
+		HC05AddrSet<HC05_MAX_DEVICES>	_detected;
+		HC05InqCallback	_inq_cb;
+		HC05KnownCache *	_known;
+		HC05Addr	_peer;			// device of the LINK in progress
+		// link recovery
+		HC05Addr	_lastPeer;		// last device connected
+		bool		_hasLast;
+		uint8_t		_recTier;		// HC05_REC_xxx in progress
+		uint8_t		_recTry;		// LINK attempts in the tier
+		uint32_t	_recSince;		// start of the tier (ms)
+		uint32_t	_recStart;		// start of the recovery (ms)
+		HC05Recovery	_rec;
+		// remote device names
+		HC05Name	_names[HC05_MAX_NAMES];
+		int8_t		_nameK;			// entry of the RNAME? in progress, -1 none
+		uint8_t		_nameNext;		// entry replaced next when the table is full
+		// asynchronous AT command
+		bool		_atBusy;
+		bool		_atOwn;			// the last command sent is one of the driver
+		int16_t		_atRet;			// result, COD_NONE while waiting
+		uint32_t	_atDeadline;
+		uint32_t	_atSent;		// when it has been sent (ms)
+		uint8_t		_atCls;			// HC05_TO_xxx learning its latency
+		HC05AtCallback	_atCb;
+		void *		_atCtx;
+		uint8_t		_atLate;		// answers still owed for canceled commands
+		uint32_t	_atLateEnd;		// they are not expected after this time
+		// baudrate
+		const uint32_t *	_bauds;		// probe order
+		uint8_t		_baudN;
+		uint32_t	_baud;			// last rate found, 0 unknown
+		uint32_t	_baudSaved;		// rate in _baudStore, 0 none
+		HC05Storage *	_baudStore;
+		// adaptive timeouts
+		HC05Timeout	_to[HC05_TO_COUNT];
+		int16_t 	_forced_state;	// Signed
+		// cached state
+		int16_t		_state;			// last state known
+		uint32_t	_state_ms;		// when _state has been read, 0 when unknown
+		int8_t		_state_pin;		// STATE pin or -1
+		// receive buffer
+		uint8_t		_rx[RX_BUFSZ];
+		uint16_t	_rxHead;		// free running write index
+		uint16_t	_rxTail;		// free running read index
+		uint8_t		_discN;			// +DISC: chars matched so far, held back from _rx
+		bool		_discSkip;		// dropping the end of the +DISC line
+		uint32_t	_discAt;		// when the last byte held back came (us)
+		// transmit buffer
+		uint8_t		_tx[TX_BUFSZ];
+		uint16_t	_txHead;		// free running write index
+		uint16_t	_txTail;		// free running read index
+		// non-blocking connection
+		uint8_t		_sub_state;		// SS_xxx
+		uint32_t	_deadline;		// end of the current sub-state (ms)
+		uint32_t	_since;			// start of the current sub-state (ms)
+		uint32_t	_probeAt;		// next AT sent while waiting for the reboot
+		bool		_probeOut;		// the last one is not answered yet
+		bool		_to_master;		// continue as a master once INIT is done
+		uint8_t		_pass;			// PASS_xxx
+		uint8_t		_cand;			// index in _detected
+		uint8_t		_lineN;			// chars of the line being received
+		uint8_t		_lineAt;		// where it is received in _atResp()
+		// scratch arena shared by the AT transactions, one at a time :
+		// commands are built from the start, answer lines are received in
+		// _atResp()
+		char		_scratch[HC05_SCRATCH_SZ];
+		// state memory
+		bool 	bootup;			// true a boot to validate / unvalidate pairing
+		bool 	reqPairing;		// switch to true to execute a pairing or re-pairing search
+		bool 	initSuccess;	// true if init finished in success
+};
+
+// -- HC05 driver on the serial port Port (HardwareSerial, SoftwareSerial,
+// the host simulator port...). Calls to the port are resolved at compile
+// time and each instance has its own state, so several modules can run
+// on different ports. Port needs begin, available, read, write, print
+// and availableForWrite. When availableForWrite() always
+// returns 0 (SoftwareSerial), writes block. Implemented in HC05c.hpp
+template<class Port> class HC05cT : public HC05cBase
+{
+	public:
+		HC05cT(Port & port) : _port(port), _txRoomKnown(false) {}
 		//Configure the bluetooth device
-		bool	setupConnection(char * devName);
-		bool	setupConnection(char * devName, char * passwd);
+		bool	setupConnection(const char * devName);
+		bool	setupConnection(const char * devName, const char * passwd);
+		// Only write the settings that differ from the module ones
+		bool	setupConnection(const HC05Config & cfg);
 		//Establsh connection to a device. return only when the connection
 		//has been done with true
 		bool	connect();
+		// Move the connection state machine forward - not blocking operation
+		// return true once connected
+		bool	tick(uint32_t now);
+		bool	poll();
 		// Receive string from bluetooth - not blocking operation
 		// return number of char received
 		// return -1 when the connection is broken
-		int16_t	receive(char *,int);
+		int16_t	receive(char *,int16_t);
+		// Number of bytes in the receive buffer - not blocking operation
+		int16_t	available();
 		// Send string over bluetooth - blocking operation
 		// return false if disconnected
-		bool	send(char *);
-   private:
+		bool	send(const char *);
+		bool	send(const uint8_t *, size_t);
+		// Queue data to send over bluetooth - not blocking operation
+		// return number of bytes accepted
+		size_t	write(const uint8_t *, size_t);
+		// Ask the module for its state (AT+STATE?) and update the cached state,
+		// the cached state is returned while an asynchronous command is waiting
+		int16_t	refreshState();
+		// Move the receive and transmit buffers - not blocking operation
+		// return the number of bytes moved, -1 when not connected
+		int16_t	pump();
+		// Send an AT command and return without waiting for its result,
+		// one at a time. atPoll() reads the result : COD_NONE until it is
+		// known (see HC05AtCallback for the codes), cb is then called with
+		// it. Not to be used while connected. Until then, the blocking
+		// commands return COD_BUSY and tick() waits
+		bool	atSend(const char * cmd, uint32_t timeout, HC05AtCallback cb, void * ctx);
+		int16_t	atPoll();
+	private:
 		bool		_getConnection();
-		void		_forceState(int16_t);
 		int16_t		_getState();
-		int16_t		_startInq(int16_t);
-		bool		_getMrad();
-		int16_t		_getADCN();
-		int16_t		_sendAtCmd(char *, boolean);
-		void		_getRName(char *);
-		// list of devices detected
-		char		detected_address[4][16];
-		int16_t		detected_addressN;
-		uint32_t	_baud_rates[6];
-		int16_t 	_forced_state;	// Signed
-		// state memory
-		bool 	bootup;			// true a boot to validate / unvalidate pairing
-		bool 	reqPairing;		// switch to true to execute a pairing or re-pairing search
-		bool 	initSuccess;	// true if init finished in success
- };
+		void		_rxPump();
+		void		_txPump();
+		int			_txRoom();
+		void		_startInq();
+		int16_t		_endInq(bool);
+		void		_startMaster(uint32_t);
+		void		_startReset(uint32_t);
+		bool		_readyStep(uint32_t);
+		void		_recoverStep(uint32_t);
+		void		_selectStep();
+		void		_linkDone(int16_t, uint32_t);
+		void		_knownStep(uint32_t);
+		void		_link(const HC05Addr &);
+		bool		getHC05Mrad();
+		int16_t		getHC05ADCN();
+		int16_t		_sendAtCmd(const char *, boolean);
+		bool		_atStart(const char *, uint32_t, uint8_t);
+		void		_atSettle();
+		void		_flushInput();
+		int16_t		_atQuery(const char *);
+		uint8_t		_sendAtBatch(const char * const *, uint8_t, int16_t *);
+		bool		_waitReady(uint32_t);
+		bool		_probe(uint32_t);
+		bool		_cfgDiffers(const char *);
+		bool		_setupBatch(const char **, uint8_t, int16_t *);
+		int16_t		_readResult(bool, uint32_t);
+		void		_sendAtRaw(const char *);
+		bool		_readLine();
+		bool		_nameStep();
+		Port &		_port;
+		bool		_txRoomKnown;	// availableForWrite() has reported some room
+};
+
+// -- Drives several links from one loop. Each run() gives every link one
+// step, in an order rotating from one run to the next : connection steps
+// until the link is up or its deadline is reached, then data pumping.
+class HC05Scheduler
+{
+	public:
+		HC05Scheduler();
+		// add a link that must be connected within timeout ms (0 : no limit)
+		// return its index, -1 when full
+		int8_t		add(HC05Link * link, uint32_t timeout);
+		// give a new connection delay to a link (after expiry or a link loss)
+		void		restart(uint8_t k, uint32_t timeout);
+		void		run(uint32_t now);
+		void		run() { run(millis()); }
+		uint8_t		size() const { return _n; }
+		bool		connected(uint8_t k) const { return _flags[k] & LNK_UP; }
+		// deadline reached before being connected, the link is not driven anymore
+		bool		expired(uint8_t k) const { return _flags[k] & LNK_EXPIRED; }
+		// longest single step of the link (ms)
+		uint16_t	worstStep(uint8_t k) const { return _worst[k]; }
+	private:
+		enum { LNK_UP = 1, LNK_EXPIRED = 2, LNK_DEADLINE = 4 };
+		HC05Link *	_link[HC05_MAX_LINKS];
+		uint32_t	_deadline[HC05_MAX_LINKS];
+		uint16_t	_worst[HC05_MAX_LINKS];
+		uint8_t		_flags[HC05_MAX_LINKS];
+		uint8_t		_n;
+		uint8_t		_first;			// link served first by the next run()
+};
+
+// -- Frames over the SPP link : HC05_FRAME_SYNC, payload length, payload
+// and CRC16 (CCITT, big endian) of length + payload. Complete frames are
+// delivered from the receive buffer. Frames sent are queued whole in the
+// transmit buffer and written by pump() in chunks as large as the serial
+// line takes, so small frames share the same writes.
+class HC05Framer
+{
+	public:
+		HC05Framer(HC05cBase & link);
+		// Next complete frame - not blocking operation
+		// return its length and set *data to its payload, -1 when none.
+		// The payload stays in the receive buffer (it is only copied when
+		// it wraps around) until release() or the next recv()
+		int16_t		recv(const uint8_t ** data);
+		void		release();
+		// Queue a frame of 1 to HC05_FRAME_MAX bytes - not blocking operation
+		// return false when there is no room for it
+		bool		send(const uint8_t * data, uint8_t len);
+		// Write the queued frames - not blocking operation
+		// return the number of bytes still queued, -1 when not connected
+		int16_t		flush();
+		// Frame of len bytes written to out (len + 4 bytes), return its size
+		static uint8_t	encode(uint8_t * out, const uint8_t * data, uint8_t len);
+		static uint16_t	crc16(uint16_t crc, uint8_t c);
+		// frames dropped on a CRC error, bytes skipped out of a frame
+		uint16_t	crcErrors() const { return _crcErrors; }
+		uint16_t	skipped() const { return _skipped; }
+	private:
+		uint8_t		_at(uint16_t k) const;
+		HC05cBase &	_link;
+		uint8_t		_held;			// size of the frame given by recv()
+		uint16_t	_crcErrors;
+		uint16_t	_skipped;
+		uint8_t		_frame[HC05_FRAME_MAX];	// payload wrapping around the receive buffer
+};
+
+// -- Capture of a serial session : every byte read from and written to
+// the port, with its time, in a compact binary form written to out.
+// It starts with "HC5R" and HC05_CAP_VERSION, then one record per chunk of
+// bytes of the same direction : tag ( kind << 6 | length - 1 ), time since
+// the previous record (us, LEB128 varint) and the bytes. A new record is
+// started when the direction changes, the chunk is full or the line was
+// idle more than HC05_CAP_GAP us. Wraps the port of an HC05cT :
+//   HC05CapturePort<HardwareSerial> cap(blueToothSerial, sdFile);
+//   HC05cT< HC05CapturePort<HardwareSerial> > hc05(cap);
+// host/replay.cpp plays a capture back against an unmodified HC05c.
+template<class Port> class HC05CapturePort
+{
+	public:
+		HC05CapturePort(Port & port, Print & out);
+		void	begin(unsigned long rate);
+		int		available() { return _port.available(); }
+		int		read();
+		int		availableForWrite() { return _port.availableForWrite(); }
+		size_t	write(uint8_t c) { return write(&c,1); }
+		size_t	write(const uint8_t * buf, size_t n);
+		size_t	write(const char * str) { return write((const uint8_t *)str,strlen(str)); }
+		size_t	print(const char * str) { return write(str); }
+		// Phase boundary (setup, connection...), id is free
+		void	mark(uint8_t id);
+		// Write the chunk being gathered, at the end of the capture
+		void	flush();
+		// Bytes written to out
+		uint32_t	size() const { return _size; }
+	private:
+		void	_add(uint8_t kind, const uint8_t * data, size_t n);
+		void	_record(uint8_t kind, const uint8_t * data, uint8_t n, uint32_t t);
+		void	_out8(uint8_t c) { _out.write(c); _size++; }
+		Port &		_port;
+		Print &		_out;
+		uint32_t	_size;
+		uint32_t	_last;			// time of the last record written (us)
+		uint32_t	_chunkT;		// time of the first byte of the chunk
+		uint32_t	_byteT;			// time of the last byte of the chunk
+		uint8_t		_kind;
+		uint8_t		_n;				// bytes in the chunk
+		uint8_t		_chunk[HC05_CAP_CHUNK];
+};
+
+#include "HC05c.hpp"
+
+// -- Type of blueToothSerial, whatever port it is defined to (Serial_ on
+// native USB boards, SoftwareSerial, ...)
+template<class T> struct HC05PortOf { typedef T type; };
+template<class T> struct HC05PortOf<T &> { typedef T type; };
+typedef HC05PortOf<decltype(blueToothSerial)>::type HC05Port;
+
+// -- HC05 driver on blueToothSerial
+class HC05c : public HC05cT<HC05Port>
+{
+	public:
+		HC05c() : HC05cT<HC05Port>(blueToothSerial) {}
+};
+
+// -- RAM used by one instance, buffers included, checked against
+// HC05_RAM_BUDGET (bytes) when it is defined. See the README for the
+// stack used per call.
+#ifdef HC05_RAM_BUDGET
+static_assert(sizeof(HC05c) <= HC05_RAM_BUDGET, "HC05c does not fit in HC05_RAM_BUDGET");
+#endif
  
 #endif
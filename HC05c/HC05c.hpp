@@ -0,0 +1,1203 @@
+/* ======================================================================
+ * HC05cT<Port> implementation, included by HC05c.h
+ * Every call to the serial port goes through _port, the type of the
+ * port is known at compile time.
+ * ======================================================================
+ */
+#ifndef _HC05C_HPP_
+#define _HC05C_HPP_
+
+/* --- Setup Bluetooth HC-05 device to be ready for inquiery
+ * Set device name as BT_CAM, passwd 0000, inquiery search_iter 10s to 1 device
+ */
+template<class Port>
+bool HC05cT<Port>::setupConnection(const char * devName){
+	return setupConnection(devName, DEFAULT_PASSWORD);
+}
+
+template<class Port>
+bool HC05cT<Port>::setupConnection(const char * devName, const char * passwd) {
+	HC05Config cfg;
+	cfg.name = devName;
+	cfg.passwd = passwd;
+	cfg.uart = 38400;           // serial over BT rate + Arduino rate (next restart)
+	cfg.iac = "9e8b33";         // use a Password for pairing
+	cfg.cmode = 1;              // connect to any address
+	return setupConnection(cfg);
+}
+
+/* --- Setup Bluetooth HC-05 device from a configuration
+ * Current settings are read back from the module and only the different
+ * ones are written, so a module already configured is not written again.
+ * The module is only reset when its state does not allow to go on.
+ */
+template<class Port>
+bool HC05cT<Port>::setupConnection(const HC05Config & cfg) {
+	const char * cmds[6];
+	int16_t res[6];
+	uint8_t n = 0;
+	uint8_t sent = 0;
+	uint8_t used = 0;           // bytes of the scratch arena used by the batch
+	int16_t state;
+	_atSettle();                // the module is set up from scratch
+	bootup = true;              // device is booting
+	initSuccess = false;
+	if ( ! _getConnection() ) {
+		hc05_log(HC05_LVL_ERROR,HC05_CAT_SETUP,SETUP_FAIL,0);
+		return false;
+	}
+	reqPairing = ( getHC05ADCN() == 0 ) ;  // if no device is already paired, request pairing.
+	state = _getState();
+	if ( state != ST_INITIALIZED && state != ST_PAIRED && state != ST_CONNECTED ) {
+		_sendAtCmd(BT_RESET, true);          // If not in a state to go on : reset
+		_waitReady(_to[HC05_TO_RESET].timeout());
+		state = _getState();
+	}
+	if ( state == ST_INITIALIZED ) cmds[n++] = BT_INIT;           // Init SPP
+	else if ( state != ST_PAIRED && state != ST_CONNECTED ) {
+		hc05_log(HC05_LVL_ERROR,HC05_CAT_SETUP,SETUP_FAIL,1);
+		return false;
+	}
+	// The settings that differ are packed one after the other in the scratch
+	// arena, the batch is sent first when the next one does not fit
+	for ( uint8_t k = 0 ; k < 5 ; k++ ) {
+		char * setting;
+		uint8_t room;
+		int len;
+		while ( true ) {
+			setting = &_scratch[used];
+			room = HC05_SCRATCH_SZ - BUFSZ - used;
+			switch ( k ) {
+				case 0 : len = snprintf(setting,room,"NAME=%.10s",cfg.name); break;            // BT displayed name
+				case 1 : len = snprintf(setting,room,"PSWD=%.10s",cfg.passwd); break;          // BT password
+				case 2 : len = snprintf(setting,room,"UART=%lu,0,0",(unsigned long)cfg.uart); break; // serial rate
+				case 3 : len = snprintf(setting,room,"IAC=%s",cfg.iac); break;                 // inquiry access code
+				default : len = snprintf(setting,room,"CMODE=%d",cfg.cmode); break;            // connection mode
+			}
+			if ( len < room || used == 0 ) break;
+			if ( ! _setupBatch(cmds,n,res) ) return false;
+			sent += n;
+			n = 0;
+			used = 0;
+		}
+		if ( _cfgDiffers(setting) ) {
+			cmds[n++] = setting;
+			used += strlen(setting) + 1;
+		}
+	}
+	if ( n > 0 && ! _setupBatch(cmds,n,res) ) return false;
+	initSuccess = true;
+	_sub_state = SS_NONE;
+	hc05_log(HC05_LVL_STEP,HC05_CAT_SETUP,SETUP_DONE,sent + n);
+	return true;
+}
+
+/* --- Send a batch of setupConnection(), the commands not answered by OK
+ * are sent once more. INIT is fine when SPP is already initialized.
+ * cmds is packed with the failed ones, res holds n results
+ * return false, logged, when one still fails
+ */
+template<class Port>
+bool HC05cT<Port>::_setupBatch(const char ** cmds, uint8_t n, int16_t * res) {
+	for ( uint8_t pass = 0 ; n > 0 ; pass++ ) {
+		uint8_t left = 0;
+		_sendAtBatch(cmds,n,res);
+		for ( uint8_t k = 0 ; k < n ; k++ ) {
+			if ( res[k] == -1 || ( cmds[k] == BT_INIT && res[k] == COD_SPP_INIT ) ) continue;
+			cmds[left++] = cmds[k];
+		}
+		if ( left > 0 && pass > 0 ) {
+			hc05_log(HC05_LVL_ERROR,HC05_CAT_SETUP,SETUP_FAIL,2);
+			return false;
+		}
+		n = left;
+	}
+	return true;
+}
+
+/* --- Check a setting against the module
+ * setting is the AT command writing it ("NAME=xxx"), the current value is
+ * read back with the matching query ("NAME?"). The query and its answer
+ * share _atResp(), setting must not be there.
+ * return true when the module value is different or can't be read
+ */
+template<class Port>
+bool HC05cT<Port>::_cfgDiffers(const char * setting) {
+	char * resp = _atResp();
+	const char * value = strchr(setting,'=');
+	const char * current;
+	uint8_t k = value - setting;
+	memcpy(resp,setting,k);
+	resp[k] = '?';
+	resp[k+1] = 0;
+	if ( _atQuery(resp) != -1 ) return true;
+	current = strchr(resp,':');
+	return ( current == NULL || strcasecmp(current + 1,value + 1) != 0 );
+}
+
+/* -------------------------------------------------------------
+ * Establsh connection to a device. return only when the connection
+ * has been done with true
+ * --------------------------------------------------------------
+ */
+template<class Port>
+bool HC05cT<Port>::connect() {
+	if ( ! initSuccess ) return false;
+	while ( ! poll() ) ;
+	return true;
+}
+
+template<class Port>
+bool HC05cT<Port>::poll() {
+	return tick(millis());
+}
+
+/* -------------------------------------------------------------
+ * Move the connection state machine forward - not blocking operation
+ * Each call executes at most one step : the long waits of the pairing
+ * process are sub-states ended by a deadline, so the caller keeps the
+ * hand between two steps.
+ * return true once connected
+ * --------------------------------------------------------------
+ */
+template<class Port>
+bool HC05cT<Port>::tick(uint32_t now) {
+	int16_t ret;
+	if ( ! initSuccess ) return false;
+	if ( _nameStep() ) return false;
+	// an asynchronous command of the application is waiting for its result
+	if ( _atBusy && ! _atOwn ) return false;
+	switch ( _sub_state ) {
+		case SS_NONE:
+			break;
+		case SS_SLEEP:
+			if ( time_reached(now,_deadline) ) _sub_state = SS_NONE;
+			return false;
+		case SS_RESET:
+			if ( ! _readyStep(now) ) return false;
+			if ( _to_master ) {
+				// Change mode to connect as a master
+				const char * cmds[] = {
+					BT_INIT,        // Init SPP
+					"ROLE=1",       // act as master
+					"CLASS=0",      // search for everything (use 200 for a smartphone)
+					_scratch        // inquiry mode
+				};
+				_to_master = false;
+				snprintf(_scratch,HC05_SCRATCH_SZ,"INQM=1,%d,%d",HC05_MAX_DEVICES,MAX_MASTER_TIME); // mode rssi, device max, timeout*1.28s max
+				_sendAtBatch(cmds,sizeof(cmds)/sizeof(cmds[0]),NULL);
+				_startInq();
+				_wait(SS_INQ,now + 1300UL*MAX_MASTER_TIME);
+			} else {
+				_sub_state = SS_INIT;
+				_atStart(BT_INIT,_to[HC05_TO_INIT].timeout(),HC05_TO_INIT);   // Init SPP
+			}
+			return false;
+		case SS_INIT:
+			// INIT is sent again when the module was not free for it
+			if ( ! _atOwn ) _atStart(BT_INIT,_to[HC05_TO_INIT].timeout(),HC05_TO_INIT);
+			else if ( atPoll() != COD_NONE ) _sub_state = SS_NONE;
+			return false;
+		case SS_SLAVE:
+			// At this point if OK is read it means that we are connected with the device ... Inquiry success and finished with +DISC
+			if ( ( ret = atPoll() ) == COD_NONE ) return false;
+			if ( ret == -1 ) {
+				_forceState(ST_PAIRED);
+				_sub_state = SS_NONE;
+			} else _startMaster(now);
+			return false;
+		case SS_INQ:
+			// results are parsed as they come, OK ends the inquiry
+			ret = COD_NONE;
+			while ( ret == COD_NONE && _readLine() ) {
+				ret = _atResult(_line());
+				if ( ret == COD_NONE && _inqLine(_line()) ) ret = COD_FAIL;
+			}
+			if ( ret == COD_NONE ) {
+				if ( ! time_reached(now,_deadline) ) return false;
+				ret = COD_TIMEOUT;
+				HC05_METRIC(_metrics.result(ret,now));
+			}
+			_endInq(ret != -1);             // still running unless OK received
+			// First try to connected to already known devices if we have, then try to pair
+			_pass = PASS_LINK;
+			_cand = 0;
+			_sub_state = SS_SELECT;
+			return false;
+		case SS_SELECT:
+			_selectStep();
+			return false;
+		case SS_PAIR:
+			if ( ( ret = atPoll() ) == COD_NONE ) return false;
+			if ( ret < 0 ) {
+				// pairing  sucess
+				_link(_detected[_cand]);
+			} else {
+				_cand++;
+				_sub_state = SS_SELECT;
+			}
+			return false;
+		case SS_LINK:
+			if ( ! _atOwn ) {
+				// LINK not sent yet, the module was not free for it
+				_atStart(_addrCmd(_scratch,"LINK=",_peer),LINK_TIMEOUT,HC05_TO_NONE);
+				return false;
+			}
+			if ( ( ret = atPoll() ) == COD_NONE ) return false;
+			_linkDone(ret,now);
+			return ( ret < 0 );
+		case SS_KNOWN:
+			_knownStep(now);
+			return false;
+		case SS_RECOVER:
+			if ( _recTier == HC05_REC_INIT && _atBusy ) {
+				// INIT sent, then LINK
+				if ( atPoll() != COD_NONE ) _link(_lastPeer);
+				return false;
+			}
+			if ( time_reached(now,_deadline) ) _recoverStep(now);
+			return false;
+	}
+
+	int16_t state=_getState();
+	hc05_log(HC05_LVL_AT,HC05_CAT_STATE,STATE,state);
+	switch ( state ) {
+		case ST_INITIALIZED:
+			// On startup, try to connect to existing device, then go for pairing if failed
+			if ( reqPairing ) {
+				reqPairing = false;
+				// Start a pairing process
+				_forceState(ST_SEARCH_FOR_PAIR);
+			}
+			else if ( getHC05ADCN() > 0 ) _forceState(ST_PAIRED);
+			// mode sleep à travailler
+			else _wait(SS_SLEEP,now + IDLE_TIME);
+			break;   
+		// Not a real existing case, just to simplify algorithm
+		case ST_SEARCH_FOR_PAIR:    
+			// for the first minute we can start to INQUIRE if someone wants to pair with us as a salve
+			_sendAtCmd("ROLE=0",true);       // slave mode
+			// Start INQUIERING => change state to pairable, OK once paired. Asked again by the next step when refused
+			if ( ! _atStart("INQ",1000UL*MAX_SLAVE_TIME,HC05_TO_NONE) ) break;
+			hc05_log(HC05_LVL_STEP,HC05_CAT_STATE,SLAVE_WAIT,0);
+			bootup=false;			      // to not re-enter ...
+			_sub_state = SS_SLAVE;
+			break;
+		case ST_INQUIERING:
+			hc05_log(HC05_LVL_STEP,HC05_CAT_STATE,INQ_INVALID,0);
+			// reset
+			_forceState(ST_NOFORCE);               // Stop Slave inquiering ... reinit
+			_startReset(now);
+			break;
+		case ST_PAIRED:
+			hc05_log(HC05_LVL_STEP,HC05_CAT_STATE,PAIRED,0);
+			// Known devices first, then the last device
+			_pass = PASS_KNOWN;
+			_cand = 0;
+			_sub_state = SS_KNOWN;
+			break;
+		case ST_DISCONNECTED:
+			hc05_log(HC05_LVL_STEP,HC05_CAT_STATE,DISC,0);
+			_forceState(ST_NOFORCE);
+			_recoverStart(now);
+			break;
+		case ST_CONNECTED:
+			if ( _recTier != HC05_REC_NONE ) {
+				// connected again without the LINK of the recovery : learn the peer from the module,
+				// a peer it cannot give is not linked again after the next +DISC
+				_hasLast = getHC05Mrad();
+				if ( _hasLast ) _lastPeer = _detected[0];
+				_discN = 0;
+				_discSkip = false;
+				_recoverEnd(now);
+			}
+			_rxPump();
+			_txPump();
+			return true;
+		default:
+			_wait(SS_SLEEP,now + RETRY_TIME);
+			break;
+	}
+	return false;
+}
+
+/* --- Slave search is over : reinit the module to inquire as a master
+ */
+template<class Port>
+void HC05cT<Port>::_startMaster(uint32_t now) {
+	hc05_log(HC05_LVL_STEP,HC05_CAT_STATE,MASTER,0);
+	// At the end of the inquiring delay, start to inquirer in master mode ... 
+	_forceState(ST_NOFORCE);               // Stop Slave inquiring ... reinit
+	_to_master = true;
+	_startReset(now);
+}
+
+/* --- Reset the module, SS_RESET ends once it answers AT again
+ */
+template<class Port>
+void HC05cT<Port>::_startReset(uint32_t now) {
+	_sendAtCmd(BT_RESET, true);
+	_wait(SS_RESET,now + _to[HC05_TO_RESET].timeout());
+	_probeAt = now;
+	_probeOut = false;
+}
+
+/* --- Module rebooting : AT is sent again each AT timeout until OK comes
+ * back. The reboot time is learnt from it, the deadline is only reached
+ * when the module does not answer. A probe left unanswered is counted as
+ * a timeout, and the boot messages are dropped before the next one as
+ * _probe() does
+ * return true once the module is ready or the deadline reached
+ */
+template<class Port>
+bool HC05cT<Port>::_readyStep(uint32_t now) {
+	bool ready = false;
+	while ( ! ready && _readLine() ) ready = ( _atResult(_line()) == -1 );
+	if ( ready ) {
+		_probeOut = false;
+		_to[HC05_TO_RESET].sample(millis() - _since);
+		return true;
+	}
+	if ( time_reached(now,_deadline) || time_reached(now,_probeAt) ) {
+		HC05_METRIC(if ( _probeOut ) _metrics.result(COD_TIMEOUT,millis()));
+		_probeOut = false;
+	}
+	if ( time_reached(now,_deadline) ) {
+		_to[HC05_TO_RESET].expired();
+		return true;
+	}
+	if ( time_reached(now,_probeAt) ) {
+		_flushInput();
+		_probeOut = true;
+		HC05_METRIC(_metrics.sent(HC05_CMD_AT,millis()));
+		_port.write("AT");
+		_port.write(CRLF);
+		_probeAt = now + _to[HC05_TO_AT].timeout();
+	}
+	return false;
+}
+
+/* --- One recovery attempt of the current tier
+ */
+template<class Port>
+void HC05cT<Port>::_recoverStep(uint32_t now) {
+	switch ( _recTier ) {
+		case HC05_REC_LINK:
+			_pass = PASS_RECOVER;
+			_link(_lastPeer);
+			break;
+		case HC05_REC_INIT:
+			_pass = PASS_RECOVER;
+			// an ERROR:(17) (already done) is fine, sent again by the next step when refused
+			_atStart(BT_INIT,_to[HC05_TO_INIT].timeout(),HC05_TO_INIT);
+			break;
+		default:
+			_startReset(now);           // whole connection process, ended by _recoverEnd() once linked
+			break;
+	}
+}
+
+/* --- Link to the next known device in ranked order, then to the module
+ * most recent used address when it has not been tried already
+ */
+template<class Port>
+void HC05cT<Port>::_knownStep(uint32_t now) {
+	int16_t k = ( _known != NULL )?_known->rank(_cand):-1;
+	if ( k >= 0 ) {
+		_link(_known->get(k).addr);
+		return;
+	}
+	_pass = PASS_MRAD;
+	if ( getHC05Mrad() && ( _known == NULL || _known->find(_detected[0]) < 0 ) ) {
+		// Connect to the last device if possible
+		_link(_detected[0]);
+	} else _mradFailed(now);
+}
+
+/* --- Send LINK to addr, the result is polled in SS_LINK. SS_LINK sends
+ * it when the module is not free for it yet
+ */
+template<class Port>
+void HC05cT<Port>::_link(const HC05Addr & addr) {
+	_peer = addr;
+	_sub_state = SS_LINK;
+	_atStart(_addrCmd(_scratch,"LINK=",addr),LINK_TIMEOUT,HC05_TO_NONE);
+}
+
+/* --- Process the next detected device
+ * PASS_LINK : link to the device if it is already in the pairing list
+ * PASS_PAIR : pair with the device if it is not in the pairing list
+ * One FSAD request is made per call
+ */
+template<class Port>
+void HC05cT<Port>::_selectStep() {
+	if ( _cand >= _detected.size() ) {
+		_cand = 0;
+		if ( ++_pass > PASS_PAIR ) {
+			_forceState(ST_NOFORCE);
+			_sub_state = SS_NONE;
+		}
+		return;
+	}
+	int16_t ret = _sendAtCmd(_addrCmd(_scratch,BT_FSAD,_detected[_cand]),true);
+	if ( ret == COD_BUSY ) return;                   // asked again by the next step
+	if ( _pass == PASS_LINK && ret < 0 ) {
+		// this address is already known ... linking
+		_link(_detected[_cand]);
+	} else if ( _pass == PASS_PAIR && ret == COD_FAIL ) {
+		strncat(_addrCmd(_scratch,"PAIR=",_detected[_cand]),",20",BUFSZ - 21);
+		if ( _atStart(_scratch,PAIR_TIMEOUT,HC05_TO_NONE) ) _sub_state = SS_PAIR;   // else asked again by the next step
+	} else _cand++;
+}
+
+/* --- LINK result received (or timed out)
+ */
+template<class Port>
+void HC05cT<Port>::_linkDone(int16_t ret, uint32_t now) {
+	_sub_state = SS_NONE;
+	if ( _known != NULL ) _known->result(_peer,ret < 0);
+	if ( ret < 0 ) {
+		_forceState(ST_CONNECTED);
+		_discN = 0;                 // the end of a previous +DISC line went through _readLine()
+		_discSkip = false;
+		_lastPeer = _peer;
+		_hasLast = true;
+		_recoverEnd(now);
+		return;
+	}
+	_sendAtCmd(" ",true); // it seems that after a AT+LINK the next AT command is not concidered
+	if ( _pass == PASS_RECOVER ) _recoverNext(now);
+	else if ( _pass == PASS_KNOWN ) {
+		_cand++;
+		_sub_state = SS_KNOWN;
+	} else if ( _pass == PASS_MRAD ) _mradFailed(now);
+	else {
+		_cand++;
+		_sub_state = SS_SELECT;
+	}
+}
+
+/* ---------------------------------------------------------------
+ * Receive string from bluetooth - not blocking operation
+ * copy at most maxsz-1 chars to buf and terminate it. The serial line is
+ * only read while connected, it carries AT answers otherwise
+ * return number of char received
+ * return -1 when the connection is broken and all data have been read
+ * ---------------------------------------------------------------
+ */
+template<class Port>
+int16_t HC05cT<Port>::receive(char * buf, int16_t maxsz) {
+	const uint8_t * data;
+	int16_t bufd = 0;
+	uint16_t n;
+	if ( maxsz <= 0 ) return 0;
+	if ( _cachedState() == ST_CONNECTED ) _rxPump();
+	// the buffer may hold two contiguous parts
+	while ( bufd < maxsz - 1 && ( n = peek(&data) ) > 0 ) {
+		if ( n > (uint16_t)(maxsz - 1 - bufd) ) n = maxsz - 1 - bufd;
+		memcpy(&buf[bufd],data,n);
+		consume(n);
+		bufd += n;
+	}
+	buf[bufd]=0;
+	if ( bufd == 0 && _cachedState() != ST_CONNECTED ) return -1;
+	return bufd;
+}
+
+/* ---------------------------------------------------------------
+ * Number of bytes waiting in the receive buffer - not blocking operation
+ * data received before a link loss stays there until read
+ * ---------------------------------------------------------------
+ */
+template<class Port>
+int16_t HC05cT<Port>::available() {
+	if ( _cachedState() == ST_CONNECTED ) _rxPump();
+	return (uint16_t)(_rxHead - _rxTail);
+}
+
+/* ---------------------------------------------------------------
+ * Move data between the serial line and the buffers - not blocking operation
+ * return the number of bytes moved, -1 when not connected
+ * ---------------------------------------------------------------
+ */
+template<class Port>
+int16_t HC05cT<Port>::pump() {
+	uint16_t rx = _rxHead, tx = _txTail;
+	if ( _cachedState() != ST_CONNECTED ) return -1;
+	_rxPump();
+	_txPump();
+	return (uint16_t)( _rxHead - rx ) + (uint16_t)( _txTail - tx );
+}
+
+/* ---------------------------------------------------------------
+ * Send string over bluetooth - blocking operation
+ * return false if disconnected
+ * ---------------------------------------------------------------
+ */
+template<class Port>
+bool HC05cT<Port>::send(const char * buf) {
+	return send((const uint8_t *)buf,strlen(buf));
+}
+
+/* ---------------------------------------------------------------
+ * Send binary data over bluetooth - blocking operation
+ * data queued by write() is sent first
+ * return false if disconnected
+ * ---------------------------------------------------------------
+ */
+template<class Port>
+bool HC05cT<Port>::send(const uint8_t * data, size_t len) {
+	size_t n;
+	if ( _cachedState() != ST_CONNECTED ) return false;
+	while ( len > 0 ) {
+		_txPump();
+		if ( _txHead == _txTail ) {
+			// nothing queued, let the serial line block
+			_port.write(data,len);
+			HC05_METRIC(_metrics.moved(0,len));
+			return true;
+		}
+		n = _txQueue(data,len);
+		data += n;
+		len -= n;
+	}
+	while ( _txHead != _txTail ) _txPump();
+	return true;
+}
+
+/* ---------------------------------------------------------------
+ * Queue binary data to be sent over bluetooth - not blocking operation
+ * data is written to the serial line as long as it accepts it without
+ * blocking, the rest is kept in the transmit buffer and sent by the next
+ * calls to write(), tick() or send()
+ * return the number of bytes accepted, 0 when the buffer is full or
+ * when disconnected
+ * ---------------------------------------------------------------
+ */
+template<class Port>
+size_t HC05cT<Port>::write(const uint8_t * data, size_t len) {
+	size_t done = 0;
+	int n;
+	if ( _cachedState() != ST_CONNECTED ) return 0;
+	_txPump();
+	if ( _txHead == _txTail ) {
+		n = _txRoom();
+		if ( n > 0 ) {
+			if ( (size_t)n > len ) n = len;
+			done = _port.write(data,n);
+			HC05_METRIC(_metrics.moved(0,done));
+		}
+	}
+	return done + _txQueue(data + done,len - done);
+}
+
+/* ======================================================================
+ * HC-05 Subroutine
+ * ======================================================================
+ */
+
+/* --- Search for HC05 device and baudrate 
+ * (peace of code from https://github.com/jdunmire/HC05 project)
+ * send AT at different baudrate and expect OK
+ * The last rate found is tried first, then the probe order. Each rate
+ * gets AT_PROBE_TIMEOUT, the last rate found one more. A HC05_PROBE_TIME
+ * shorter than that bounds the whole search : the last rates of the
+ * table are then skipped when the first ones do not answer
+ * return true is found, false otherwise.
+ */
+template<class Port>
+bool HC05cT<Port>::_getConnection() {
+	uint32_t deadline = millis() + ( ( HC05_PROBE_TIME > 0 )?HC05_PROBE_TIME:( _baudN + 1UL ) * AT_PROBE_TIMEOUT );
+	uint32_t last = _baud;
+	for ( int16_t rn = -1 ; rn < _baudN ; rn++ ) {
+		uint32_t rate = ( rn < 0 )?last:_bauds[rn];
+		uint32_t left = deadline - millis();
+		if ( rate == 0 || ( rn >= 0 && rate == last ) ) continue;
+		if ( time_reached(millis(),deadline) ) break;
+		hc05_log(HC05_LVL_AT,HC05_CAT_SETUP,PROBE_RATE,rate);
+		_port.begin(rate);
+		if ( _probe(( left < AT_PROBE_TIMEOUT )?left:AT_PROBE_TIMEOUT) ) {
+			hc05_log(HC05_LVL_STEP,HC05_CAT_SETUP,PROBE_FOUND,rate);
+			_baudFound(rate);
+			return true;
+		} 
+	}
+	hc05_log(HC05_LVL_ERROR,HC05_CAT_SETUP,PROBE_NONE,0);
+	return false;
+}
+
+/* --- Move received bytes from the serial line to the receive buffer
+ * +DISC: is searched byte per byte so it is found even when split over
+ * several reads. The bytes matching its start are held back (they are
+ * BT_DISC[0.._discN-1]) and only stored once another byte shows they
+ * are data, or once the line stays idle HC05_HOLD_GAP us, so the
+ * application never gets part of the marker. The marker and the rest of
+ * its line are removed from the data, and reading stops there : the
+ * next lines are AT answers. Nothing is read when the buffer is full :
+ * bytes stay in the serial line buffer until the application consumes
+ * some.
+ */
+template<class Port>
+void HC05cT<Port>::_rxPump() {
+	HC05_METRIC(uint16_t head = _rxHead);
+	while ( (uint16_t)(_rxHead - _rxTail) + _discN < RX_BUFSZ && _port.available() > 0 ) {
+		char c = _port.read();
+		if ( _discSkip ) {
+			if ( c != '\n' ) continue;
+			// +DISC line over : what follows is for the AT commands
+			_discSkip = false;
+			break;
+		}
+		if ( c == BT_DISC[_discN] ) {
+			_discAt = micros();
+			if ( ++_discN == sizeof(BT_DISC) - 1 ) {
+				// detect disconnection, the marker has not been stored
+				_discN = 0;
+				_discSkip = true;
+				_setDisconnected();
+			}
+			continue;
+		}
+		// not the marker : store what was held back
+		for ( uint8_t k = 0 ; k < _discN ; k++ ) _rx[_rxHead++ & (RX_BUFSZ - 1)] = BT_DISC[k];
+		_discN = 0;
+		if ( c == BT_DISC[0] ) {
+			_discN = 1;
+			_discAt = micros();
+			continue;
+		}
+		_rx[_rxHead & (RX_BUFSZ - 1)] = c;
+		_rxHead++;
+	}
+	if ( _discN > 0 && _port.available() == 0 && micros() - _discAt > HC05_HOLD_GAP ) {
+		// the line went idle : the held back bytes were data
+		for ( uint8_t k = 0 ; k < _discN ; k++ ) _rx[_rxHead++ & (RX_BUFSZ - 1)] = BT_DISC[k];
+		_discN = 0;
+	}
+	HC05_METRIC(_metrics.moved(_rxHead - head,0));
+}
+
+/* --- Room in the serial line transmit buffer
+ * Ports that do not implement availableForWrite() (SoftwareSerial, any
+ * Print) always report 0 : until the port has reported some room once,
+ * the whole transmit buffer is given and the writes block
+ */
+template<class Port>
+int HC05cT<Port>::_txRoom() {
+	int n = _port.availableForWrite();
+	if ( n > 0 ) _txRoomKnown = true;
+	else if ( ! _txRoomKnown ) n = TX_BUFSZ;
+	return n;
+}
+
+/* --- Move the transmit buffer to the serial line, by contiguous chunks,
+ * as long as the serial line accepts them without blocking
+ */
+template<class Port>
+void HC05cT<Port>::_txPump() {
+	int n;
+	while ( _txHead != _txTail && ( n = _txRoom() ) > 0 ) {
+		uint16_t start = _txTail & (TX_BUFSZ - 1);
+		uint16_t len = _txHead - _txTail;
+		if ( len > TX_BUFSZ - start ) len = TX_BUFSZ - start;
+		if ( len > (uint16_t)n ) len = n;
+		len = _port.write(&_tx[start],len);
+		HC05_METRIC(_metrics.moved(0,len));
+		_txTail += len;
+	}
+}
+
+/* --- Get the state, asking the module again only when it was not learned
+ * since STATE_STALE_TIME or when an AT command may have changed it
+ */
+template<class Port>
+int16_t HC05cT<Port>::_getState() {
+	if ( _forced_state != ST_NOFORCE ) return _forced_state;
+	if ( _state_pin >= 0 && digitalRead(_state_pin) == HIGH ) _state = ST_CONNECTED;
+	else if ( _state_ms == 0 || millis() - _state_ms >= STATE_STALE_TIME ) return refreshState();
+	else if ( _state_pin >= 0 && _state == ST_CONNECTED ) _state = ST_DISCONNECTED;
+	HC05_METRIC(_noteState());
+	return _state;
+}
+
+/* --- Get STATE return state code, according to:
+ * -1 : ERROR            -2 : NOFORCE    -3 : SEARCH_FOR_PAIR
+ *  0 : INITIALIZED      1 : READY        2 : PAIRABLE    3 : PAIRED
+ *  4 : INQUIRING        5 : CONNECTING   6 : CONNECTED   7 : DISCONNECTED
+ *  8 : NUKNOW
+ */
+template<class Port>
+int16_t HC05cT<Port>::refreshState() {
+	char * _buffer = _atResp();
+	int16_t ret = ST_ERROR;
+	if ( _atBusy && _forced_state == ST_NOFORCE ) return _state;     // can't ask now, keep the cached state
+	if (_forced_state == ST_NOFORCE ) {
+		if ( _atQuery("STATE?") == -1 ) {
+			uint8_t len = strlen(_buffer);
+			if ( len > 10 ) {
+				switch (_buffer[7]) {
+					case 'R' : ret= 1; break; 
+					case 'D' : ret= 7; break;
+					case 'I' : ret= (_buffer[9]=='I')?0:4; break;
+					case 'P' : ret= (_buffer[11]=='A')?2:3; break;
+					case 'C' : if ( len > 14 ) ret = ( _buffer[14] == 'I')?5:6; else ret= ST_ERROR; break;    
+					default : ret = ST_ERROR; break;
+				}
+			}
+		} else ret= ST_ERROR;
+		_state = ret;
+		if ( ret != ST_ERROR ) _state_ms = millis();
+		HC05_METRIC(_noteState());
+	} else	ret = _forced_state;
+	// Other cases : consider as valid command
+	hc05_log(HC05_LVL_AT,HC05_CAT_STATE,STATE_READ,ret);
+	return ret;   
+}
+
+/* --- Start Enquiring
+ * start inquiring with the mode set by INQM, results are parsed by
+ * _inqLine() as they come on the serial line
+ */
+template<class Port>
+void HC05cT<Port>::_startInq() {
+	hc05_log(HC05_LVL_STEP,HC05_CAT_INQ,INQ_START,0);
+	_detected.clear();
+	_sendAtRaw("INQ");                        // start INQ
+}
+
+/* --- End Enquiring
+ * cancel : the inquiry is still running and must be stopped
+ * return number of results
+ */
+template<class Port>
+int16_t HC05cT<Port>::_endInq(bool cancel) {
+	if ( cancel ) _sendAtCmd("INQC",true);                  // Retour etat INITIALIZED
+	hc05_log(HC05_LVL_STEP,HC05_CAT_INQ,INQ_END,_detected.size());
+	return _detected.size();   
+}
+
+/* --- Get MRAD - Most Recent Used Address
+ * return it in _detected[0], empty this table if not failed
+ */
+template<class Port>
+bool HC05cT<Port>::getHC05Mrad() {
+	char * _buffer = _atResp();
+	if ( _atQuery("MRAD?") == -1 ) {
+		HC05Addr addr;
+		if ( _buffer[0]=='+' && _buffer[1] == 'M' && strlen(_buffer) > 6 && addr.parse(&_buffer[6]) != NULL ) {
+			_detected.clear();
+			_detected.add(addr);
+			hc05_log(HC05_LVL_AT,HC05_CAT_INQ,MRAD,1);
+			return true;
+		}
+	}
+	// Other cases : consider as valid command
+	hc05_log(HC05_LVL_AT,HC05_CAT_INQ,MRAD,0);
+	return false;
+}
+
+/* --- Get ADCN value
+ * ADCN is the number of paired devices stored in the memory
+ * return the number from response format : +ADCN:X where X is the value on 1 or 2 digit
+ * return -1 when error
+ */
+template<class Port>
+int16_t HC05cT<Port>::getHC05ADCN(){
+	char * _buffer = _atResp();
+	int16_t ret = -1;
+	if ( _atQuery("ADCN?") == -1 && strlen(_buffer) > 6 ) {
+		if ( _buffer[0] == '+' ) {
+			ret = _buffer[6] - '0'; 
+			if ( _buffer[7] >= '0' && _buffer[7] <= '9' ) ret = 10 * ret + _buffer[7] - '0';
+		}
+	}
+	else ret = -1;
+	// Other cases : consider as valid command
+	hc05_log(HC05_LVL_AT,HC05_CAT_INQ,ADCN,ret);
+	return ret;   
+}
+
+/* --- Send AT Command and get Error code back
+ * imediate : when true directly read result, do not wait them to come
+ *            make sense when you are not waiting for a remote device answer
+ *
+ * Send AT command over _port then return -1 id OK error code otherwise
+ * According to Doc
+ * 0 - AT CMD Error           1 - Default result      2 - PSKEY write error      3 - Too Long
+ * 4 - No Dev Name            5 - Bt NAP too long     6 - BT UAP too long        7 - BT LAP too long
+ * 8 - No PIO num mask        9 - No PIO Num          10 - No BT device         11 - Too lenght of device
+ * 12 - No Inquire ac        13 - Too long inq ac     14 - Invalid inq ac code  15 - Passkay Lenght is 0
+ * 16 - Passkey len too long 17 - Invalide modul role 18 - Invalid baud rate    19 - Invalid strop bit
+ * 20 - Invalid parity bit   21 - auth dev not pair   22 - SPP not init         23 - SPP has been init
+ * 24 - Invalid inq mode     25 - Too long inq search_iter   26 - No BT addresse       27 - Invalid safe mode
+ * 28 - Invalid encryptmode  30 - FAIL                31 - Timeout (no answer)
+ * 32 - Busy (an asynchronous command is waiting, nothing sent)
+ *
+ * The result is returned as soon as the module answers, the wait is bounded
+ * by the adaptive AT timeout (PAIR_TIMEOUT when not imediate)
+ */
+template<class Port>
+int16_t HC05cT<Port>::_sendAtCmd(const char * atcmdstr, boolean imediate) {
+	int16_t ret;
+	if ( ! _atStart(atcmdstr,(imediate)?_to[HC05_TO_AT].timeout():PAIR_TIMEOUT,(imediate)?HC05_TO_AT:HC05_TO_NONE) ) return COD_BUSY;
+	while ( ( ret = atPoll() ) == COD_NONE ) ;
+	return ret;  
+}
+
+/* --- Send an AT command without waiting for its result - not blocking operation
+ * the result is read by atPoll(), cb (when not NULL) is called with it
+ * return false when another command is still waiting for its result
+ */
+template<class Port>
+bool HC05cT<Port>::atSend(const char * atcmdstr, uint32_t timeout, HC05AtCallback cb, void * ctx) {
+	if ( _atBusy ) return false;
+	_atBusy = true;
+	_atRet = COD_NONE;
+	_atCb = cb;
+	_atCtx = ctx;
+	_atCls = HC05_TO_NONE;
+	_atSent = millis();
+	_atDeadline = _atSent + timeout;
+	_atOwn = false;
+	_sendAtRaw(atcmdstr);
+	return true;
+}
+
+/* --- atSend() for the commands of the driver, cls is the HC05_TO_xxx
+ * learning its latency. tick() goes on while they wait, not while a command
+ * of the application does
+ * return false, nothing sent, when another command is waiting : the caller
+ * sends it again at the next step
+ */
+template<class Port>
+bool HC05cT<Port>::_atStart(const char * atcmdstr, uint32_t timeout, uint8_t cls) {
+	if ( ! atSend(atcmdstr,timeout,NULL,NULL) ) return false;
+	_atOwn = true;
+	_atCls = cls;
+	return true;
+}
+
+/* --- Wait for the command in flight, then for the answers the canceled
+ * ones still owe, so that none is taken for the result of another
+ */
+template<class Port>
+void HC05cT<Port>::_atSettle() {
+	while ( _atBusy ) atPoll();
+	while ( _atLate > 0 && ! time_reached(millis(),_atLateEnd) ) {
+		if ( _readLine() ) _atResult(_line());     // dropped there
+	}
+	_atLate = 0;
+}
+
+/* --- Drop what the module has sent, the answers still owed by canceled
+ * commands go with it
+ */
+template<class Port>
+void HC05cT<Port>::_flushInput() {
+	while ( _port.available() > 0 ) _port.read();
+	_lineN = 0;
+	_atLate = 0;
+	_atLateEnd = 0;
+}
+
+/* --- Result of the command started by atSend() - not blocking operation
+ * Lines other than OK / ERROR:(x) / FAIL are skipped
+ * return COD_NONE while waiting, then -1 for OK, the error code, COD_FAIL,
+ * COD_TIMEOUT or COD_CANCEL until the next atSend(). The callback is called
+ * once, when the result is known
+ */
+template<class Port>
+int16_t HC05cT<Port>::atPoll() {
+	int16_t ret = COD_NONE;
+	if ( ! _atBusy ) return _atRet;
+	while ( ret == COD_NONE && _readLine() ) {
+		ret = _atResult(_line());
+		if ( ret == COD_NONE ) _atInfo(_line());
+	}
+	if ( ret == COD_NONE ) {
+		if ( ! time_reached(millis(),_atDeadline) ) return COD_NONE;
+		ret = COD_TIMEOUT;
+		hc05_log(HC05_LVL_ERROR,HC05_CAT_AT,AT_TIMEOUT,0);
+		HC05_METRIC(_metrics.result(COD_TIMEOUT,millis()));
+	}
+	_atDone(ret);
+	return ret;
+}
+
+/* --- Send AT query and get the +XXX: response line back in _atResp()
+ * (empty if none), atcmdstr may be there
+ * return -1 if OK, error code otherwise, COD_BUSY while an asynchronous
+ * command is waiting
+ */
+template<class Port>
+int16_t HC05cT<Port>::_atQuery(const char * atcmdstr) {
+	uint32_t sent = millis();
+	int16_t ret;
+	if ( _atBusy ) {
+		_atResp()[0] = 0;
+		return COD_BUSY;
+	}
+	_sendAtRaw(atcmdstr);
+	ret = _readResult(true,_to[HC05_TO_AT].timeout());
+	if ( ret == COD_TIMEOUT ) _to[HC05_TO_AT].expired();
+	else _to[HC05_TO_AT].sample(millis() - sent);
+	return ret;
+}
+
+/* --- Read the result of an AT command
+ * Return as soon as a OK / ERROR:(x) / FAIL line is received. When keep
+ * is true, the last +XXX: line received before is kept at the start of
+ * _atResp() (empty if none) : the next lines are received after it, so it
+ * is cut to leave room for a result line. The trailing OK of a query is
+ * part of the same answer so it is consumed too.
+ * return -1 for OK, error code, COD_FAIL or COD_TIMEOUT when timeout (ms) is reached
+ */
+template<class Port>
+int16_t HC05cT<Port>::_readResult(bool keep, uint32_t timeout) {
+	uint32_t deadline = millis() + timeout;
+	char * resp = _atResp();
+	int16_t ret = COD_TIMEOUT;
+	do {
+		if ( _readLine() ) {
+			char * line = _line();
+			uint8_t len = strlen(line);
+			if ( ( ret = _atResult(line) ) != COD_NONE ) break;
+			if ( keep ) {
+				if ( len > BUFSZ - AT_RESULT_SZ - 1 ) len = BUFSZ - AT_RESULT_SZ - 1;
+				memmove(resp,line,len);
+				resp[len] = 0;
+				_lineAt = len + 1;
+			}
+			ret = COD_TIMEOUT;
+		}
+	} while ( ! time_reached(millis(),deadline) );
+	if ( _lineAt == 0 ) resp[0] = 0;           // the result line was there
+	_lineAt = 0;
+	if ( ret == COD_TIMEOUT ) {
+		hc05_log(HC05_LVL_ERROR,HC05_CAT_AT,AT_TIMEOUT,0);
+		HC05_METRIC(_metrics.result(COD_TIMEOUT,millis()));
+	}
+	return ret;
+}
+
+/* --- Send a batch of AT Commands
+ * Commands are streamed to the module with up to AT_PIPELINE of them
+ * waiting for their result, results are matched to the commands in order.
+ * results (when not NULL) receives the result code of each command,
+ * COD_BUSY for all when an asynchronous command is waiting
+ * return the number of commands not answered by OK
+ */
+template<class Port>
+uint8_t HC05cT<Port>::_sendAtBatch(const char * const * atcmds, uint8_t n, int16_t * results) {
+	uint8_t sent = 0, done = 0, failed = 0;
+	int16_t ret;
+	if ( _atBusy ) {
+		for ( ; results != NULL && done < n ; done++ ) results[done] = COD_BUSY;
+		return n;
+	}
+	while ( done < n ) {
+		while ( sent < n && sent - done < AT_PIPELINE ) _sendAtRaw(atcmds[sent++]);
+		ret = _readResult(false,_to[HC05_TO_AT].timeout());
+		if ( results != NULL ) results[done] = ret;
+		if ( ret != -1 ) failed++;
+		done++;
+	}
+	hc05_log(HC05_LVL_AT,HC05_CAT_AT,AT_BATCH,failed);
+	return failed;
+}
+
+/* --- Wait for the module to answer again after a RESET
+ * AT is sent until OK is received
+ * return false when timeout (ms) is reached
+ */
+template<class Port>
+bool HC05cT<Port>::_waitReady(uint32_t timeout) {
+	uint32_t start = millis();
+	uint32_t deadline = start + timeout;
+	do {
+		if ( _probe(AT_PROBE_TIMEOUT) ) {
+			_to[HC05_TO_RESET].sample(millis() - start);
+			return true;
+		}
+	} while ( ! time_reached(millis(),deadline) );
+	_to[HC05_TO_RESET].expired();
+	return false;
+}
+
+/* --- Send AT and wait for OK, other bytes are skipped (garbage when the
+ * rate is wrong, boot messages). The answer is accepted as soon as O and K
+ * are received, the end of the line is an empty line skipped later
+ * return false when timeout (ms) is reached
+ */
+template<class Port>
+bool HC05cT<Port>::_probe(uint32_t timeout) {
+	uint32_t deadline = millis() + timeout;
+	char prev = 0;
+	_flushInput();
+	HC05_METRIC(_metrics.sent(HC05_CMD_AT,millis()));
+	_port.write("AT");
+	_port.write(CRLF);
+	do {
+		while ( _port.available() > 0 ) {
+			char c = _port.read();
+			if ( prev == 'O' && c == 'K' ) {
+				HC05_METRIC(_metrics.result(-1,millis()));
+				return true;
+			}
+			prev = c;
+		}
+	} while ( ! time_reached(millis(),deadline) );
+	HC05_METRIC(_metrics.result(COD_TIMEOUT,millis()));
+	return false;
+}
+
+/* --- Send AT Command without waiting for the result
+ * result is read later line by line with _readLine()
+ */
+template<class Port>
+void HC05cT<Port>::_sendAtRaw(const char * atcmdstr) {
+	_state_ms = 0;                            // the command may change the state
+	hc05_log(HC05_LVL_AT,HC05_CAT_AT,AT_SEND,HC05Log::tag(atcmdstr));
+	HC05_METRIC(_metrics.sent(HC05Metrics::classOf(atcmdstr),millis()));
+	_port.print("AT+");
+	_port.print(atcmdstr);
+	_port.print(CRLF); 
+}
+
+/* --- Read a response line - not blocking operation
+ * Accumulate available chars in _line(), return true when a complete
+ * line has been received, _line() is then terminated and '\r' removed
+ */
+template<class Port>
+bool HC05cT<Port>::_readLine() {
+	while ( _port.available() > 0 ) {
+		char c = _port.read();
+		if ( c == '\r' ) continue;
+		if ( c == '\n' ) {
+			if ( _lineN == 0 ) continue;     // skip empty lines
+			_line()[_lineN] = 0;
+			_lineN = 0;
+			return true;
+		}
+		if ( _lineN < BUFSZ - _lineAt - 1 ) _line()[_lineN++] = c;
+	}
+	return false;
+}
+
+/* --- Resolve the requested remote names, one RNAME? at a time
+ * RNAME? is only sent while idle or between two detected devices, its
+ * answer is polled by the next calls
+ * AT+RNAME?34C0,59,F191D5 -> +RNAME:name
+ * return true when the step has been used for a name
+ */
+template<class Port>
+bool HC05cT<Port>::_nameStep() {
+	int16_t ret;
+	uint8_t k;
+	if ( _nameK >= 0 ) {
+		if ( ( ret = atPoll() ) != COD_NONE ) _nameDone(ret);
+		return true;
+	}
+	if ( _sub_state != SS_SLEEP && _sub_state != SS_SELECT ) return false;
+	for ( k = 0 ; k < HC05_MAX_NAMES && _names[k].st != NAME_QUEUED ; k++ ) ;
+	if ( k == HC05_MAX_NAMES ) return false;
+	if ( ! _atStart(_addrCmd(_scratch,"RNAME?",_names[k].addr),RNAME_TIMEOUT,HC05_TO_NONE) ) return false;
+	hc05_log(HC05_LVL_AT,HC05_CAT_INQ,RNAME,_names[k].addr.lap());
+	_names[k].st = NAME_SENT;
+	_nameK = k;
+	return true;
+}
+
+/* --- Capture of the serial session
+ * Bytes are gathered by direction and written as records to out, see
+ * HC05CapturePort in HC05c.h for the format
+ */
+template<class Port>
+HC05CapturePort<Port>::HC05CapturePort(Port & port, Print & out) : _port(port), _out(out) {
+	_size = 0;
+	_last = 0;
+	_chunkT = 0;
+	_byteT = 0;
+	_kind = HC05_CAP_RX;
+	_n = 0;
+}
+
+template<class Port>
+void HC05CapturePort<Port>::begin(unsigned long rate) {
+	uint8_t b[4];
+	flush();
+	for ( uint8_t k = 0 ; k < 4 ; k++ ) b[k] = (uint8_t)( rate >> ( 8 * k ) );
+	_record(HC05_CAP_BEGIN,b,4,micros());
+	_port.begin(rate);
+}
+
+template<class Port>
+int HC05CapturePort<Port>::read() {
+	int c = _port.read();
+	if ( c >= 0 ) {
+		uint8_t b = (uint8_t)c;
+		_add(HC05_CAP_RX,&b,1);
+	}
+	return c;
+}
+
+template<class Port>
+size_t HC05CapturePort<Port>::write(const uint8_t * buf, size_t n) {
+	size_t done = _port.write(buf,n);
+	_add(HC05_CAP_TX,buf,done);
+	return done;
+}
+
+template<class Port>
+void HC05CapturePort<Port>::mark(uint8_t id) {
+	flush();
+	_record(HC05_CAP_MARK,&id,1,micros());
+}
+
+template<class Port>
+void HC05CapturePort<Port>::flush() {
+	if ( _n == 0 ) return;
+	_record(_kind,_chunk,_n,_chunkT);
+	_n = 0;
+}
+
+/* --- Gather bytes in the current chunk
+ * the chunk is written first when the direction changes, it is full or
+ * the line has been idle more than HC05_CAP_GAP
+ */
+template<class Port>
+void HC05CapturePort<Port>::_add(uint8_t kind, const uint8_t * data, size_t n) {
+	if ( n == 0 ) return;
+	uint32_t t = micros();
+	for ( size_t k = 0 ; k < n ; k++ ) {
+		if ( _n > 0 && ( kind != _kind || _n == HC05_CAP_CHUNK || t - _byteT > HC05_CAP_GAP ) ) flush();
+		if ( _n == 0 ) {
+			_kind = kind;
+			_chunkT = t;
+		}
+		_chunk[_n++] = data[k];
+		_byteT = t;
+	}
+}
+
+/* --- Write one record : tag, time since the previous one, bytes
+ * the header goes before the first record
+ */
+template<class Port>
+void HC05CapturePort<Port>::_record(uint8_t kind, const uint8_t * data, uint8_t n, uint32_t t) {
+	uint32_t dt = t - _last;
+	if ( _size == 0 ) {
+		_out8('H'); _out8('C'); _out8('5'); _out8('R');
+		_out8(HC05_CAP_VERSION);
+	}
+	_out8(( kind << 6 ) | ( n - 1 ));
+	while ( dt >= 0x80 ) {
+		_out8(0x80 | ( dt & 0x7F ));
+		dt >>= 7;
+	}
+	_out8(dt);
+	for ( uint8_t k = 0 ; k < n ; k++ ) _out8(data[k]);
+	_last = t;
+}
+
+#endif
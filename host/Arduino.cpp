@@ -0,0 +1,180 @@
+/* ======================================================================
+ * Minimal Arduino API for building HC05c on a Linux host
+ * ======================================================================
+ */
+#include <Arduino.h>
+
+static uint64_t	_now_us = 0;
+static uint8_t	_pins[256];
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+HardwareSerial Serial2;
+HardwareSerial Serial3;
+
+/* --- Virtual clock
+ * reading it costs HOST_POLL_US so busy loops waiting for a deadline end
+ */
+unsigned long millis() {
+	_now_us += HOST_POLL_US;
+	return (unsigned long)( _now_us / 1000 );
+}
+
+unsigned long micros() {
+	_now_us += HOST_POLL_US;
+	return (unsigned long)_now_us;
+}
+
+void delay(unsigned long ms) {
+	_now_us += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+	_now_us += us;
+}
+
+uint64_t host_now_us() {
+	return _now_us;
+}
+
+void host_advance_us(uint64_t us) {
+	_now_us += us;
+}
+
+/* --- Pins
+ */
+void pinMode(uint8_t, uint8_t) {
+}
+
+int digitalRead(uint8_t pin) {
+	return _pins[pin];
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+	_pins[pin] = val;
+}
+
+void host_pin(uint8_t pin, uint8_t val) {
+	_pins[pin] = val;
+}
+
+/* --- Print / Stream
+ */
+size_t Print::write(const uint8_t * buf, size_t n) {
+	size_t done = 0;
+	while ( done < n && write(buf[done]) == 1 ) done++;
+	return done;
+}
+
+size_t Print::print(long v, int base) {
+	char buf[24];
+	if ( base == HEX ) snprintf(buf,sizeof(buf),"%lX",v);
+	else snprintf(buf,sizeof(buf),"%ld",v);
+	return write(buf);
+}
+
+size_t Print::print(unsigned long v, int base) {
+	char buf[24];
+	if ( base == HEX ) snprintf(buf,sizeof(buf),"%lX",v);
+	else snprintf(buf,sizeof(buf),"%lu",v);
+	return write(buf);
+}
+
+size_t Print::print(double v, int digits) {
+	char buf[40];
+	snprintf(buf,sizeof(buf),"%.*f",digits,v);
+	return write(buf);
+}
+
+size_t Stream::readBytes(char * buf, size_t n) {
+	size_t done = 0;
+	unsigned long start = millis();
+	while ( done < n ) {
+		if ( available() > 0 ) buf[done++] = read();
+		else if ( millis() - start >= _timeout ) break;
+	}
+	return done;
+}
+
+/* --- HardwareSerial
+ * the device receives each written byte at the time it has been shifted
+ * out of the transmit buffer on the line
+ */
+
+HardwareSerial::HardwareSerial() {
+	_dev = NULL;
+	_echo = NULL;
+	_baud = 9600;
+	_rxHead = _rxTail = 0;
+	_txHead = _txTail = 0;
+	_txNext = 0;
+	_overruns = 0;
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+	flush();
+	_baud = baud;
+	_rxHead = _rxTail = 0;
+	if ( _dev != NULL ) _dev->begin(*this,baud);
+}
+
+void HardwareSerial::_txDrain() {
+	while ( _txHead != _txTail && _txNext <= _now_us ) {
+		uint8_t c = _tx[_txTail++ % SERIAL_TX_BUFFER_SIZE];
+		if ( _dev != NULL ) _dev->received(c,_txNext);
+		_txNext += byteTimeUs();
+	}
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	if ( _echo != NULL ) fputc(c,_echo);
+	if ( _dev == NULL ) return 1;
+	_txDrain();
+	if ( (uint16_t)( _txHead - _txTail ) == SERIAL_TX_BUFFER_SIZE ) {
+		// buffer full : block until one byte is out
+		_now_us = _txNext;
+		_txDrain();
+	}
+	if ( _txHead == _txTail ) _txNext = _now_us + byteTimeUs();
+	_tx[_txHead++ % SERIAL_TX_BUFFER_SIZE] = c;
+	return 1;
+}
+
+int HardwareSerial::availableForWrite() {
+	if ( _dev == NULL ) return SERIAL_TX_BUFFER_SIZE;
+	_txDrain();
+	return SERIAL_TX_BUFFER_SIZE - (uint16_t)( _txHead - _txTail );
+}
+
+void HardwareSerial::flush() {
+	while ( _txHead != _txTail ) {
+		if ( _now_us < _txNext ) _now_us = _txNext;
+		_txDrain();
+	}
+}
+
+bool HardwareSerial::inject(uint8_t c) {
+	if ( (uint16_t)( _rxHead - _rxTail ) >= SERIAL_RX_BUFFER_SIZE ) {
+		_overruns++;
+		return false;
+	}
+	_rx[_rxHead++ % SERIAL_RX_BUFFER_SIZE] = c;
+	return true;
+}
+
+int HardwareSerial::available() {
+	_now_us += HOST_POLL_US;
+	_txDrain();
+	if ( _dev != NULL ) _dev->service();
+	return (uint16_t)( _rxHead - _rxTail );
+}
+
+int HardwareSerial::peek() {
+	if ( available() == 0 ) return -1;
+	return _rx[_rxTail % SERIAL_RX_BUFFER_SIZE];
+}
+
+int HardwareSerial::read() {
+	if ( available() == 0 ) return -1;
+	return _rx[_rxTail++ % SERIAL_RX_BUFFER_SIZE];
+}
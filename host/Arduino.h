@@ -0,0 +1,145 @@
+/* ======================================================================
+ * Minimal Arduino API for building HC05c on a Linux host
+ * Time is virtual : millis() / micros() only move forward when the code
+ * waits (delay, serial polling) so runs are fast and reproducible.
+ * ======================================================================
+ */
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH	1
+#define LOW		0
+#define INPUT	0
+#define OUTPUT	1
+#define DEC		10
+#define HEX		16
+
+// -- Virtual clock
+#ifndef HOST_POLL_US
+#define HOST_POLL_US	10		// time spent by each clock or serial poll
+#endif
+
+unsigned long	millis();
+unsigned long	micros();
+void			delay(unsigned long ms);
+void			delayMicroseconds(unsigned int us);
+uint64_t		host_now_us();			// current virtual time, does not advance it
+void			host_advance_us(uint64_t us);
+
+// -- Pins, all inputs read the value set by host_pin()
+void	pinMode(uint8_t pin, uint8_t mode);
+int		digitalRead(uint8_t pin);
+void	digitalWrite(uint8_t pin, uint8_t val);
+void	host_pin(uint8_t pin, uint8_t val);
+
+class Print
+{
+	public:
+		virtual ~Print() {}
+		virtual size_t	write(uint8_t) = 0;
+		virtual size_t	write(const uint8_t * buf, size_t n);
+		size_t			write(const char * str) { return ( str == NULL )?0:write((const uint8_t *)str,strlen(str)); }
+		size_t			write(const char * buf, size_t n) { return write((const uint8_t *)buf,n); }
+		virtual int		availableForWrite() { return 0; }
+		virtual void	flush() {}
+
+		size_t	print(const char * s) { return write(s); }
+		size_t	print(char c) { return write((uint8_t)c); }
+		size_t	print(unsigned char v, int base = DEC) { return print((unsigned long)v,base); }
+		size_t	print(int v, int base = DEC) { return print((long)v,base); }
+		size_t	print(unsigned int v, int base = DEC) { return print((unsigned long)v,base); }
+		size_t	print(long v, int base = DEC);
+		size_t	print(unsigned long v, int base = DEC);
+		size_t	print(double v, int digits = 2);
+		size_t	println() { return write("\r\n"); }
+		template<class T> size_t println(T v) { size_t n = print(v); return n + println(); }
+		template<class T> size_t println(T v, int f) { size_t n = print(v,f); return n + println(); }
+};
+
+class Stream : public Print
+{
+	public:
+		Stream() : _timeout(1000) {}
+		virtual int		available() = 0;
+		virtual int		read() = 0;
+		virtual int		peek() = 0;
+		void	setTimeout(unsigned long ms) { _timeout = ms; }
+		size_t	readBytes(char * buf, size_t n);
+		size_t	readBytes(uint8_t * buf, size_t n) { return readBytes((char *)buf,n); }
+	protected:
+		unsigned long	_timeout;
+};
+
+// -- Device plugged on a HardwareSerial port (HC05Sim, replay...)
+class HardwareSerial;
+class SerialDevice
+{
+	public:
+		virtual ~SerialDevice() {}
+		virtual void	begin(HardwareSerial & port, unsigned long baud) = 0;
+		virtual void	received(uint8_t c, uint64_t t_us) = 0;	// byte written by the MCU, out of the line at t_us
+		virtual void	service() = 0;					// deliver what is due at host_now_us()
+};
+
+// -- UART model : bytes take 10 bit times on the line, the transmit side
+// has a SERIAL_TX_BUFFER_SIZE buffer, the receive side SERIAL_RX_BUFFER_SIZE
+#ifndef SERIAL_TX_BUFFER_SIZE
+#define SERIAL_TX_BUFFER_SIZE 64
+#endif
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE 64
+#endif
+
+class HardwareSerial : public Stream
+{
+	public:
+		HardwareSerial();
+		void	begin(unsigned long baud);
+		void	end() {}
+		int		available();
+		int		read();
+		int		peek();
+		size_t	write(uint8_t c);
+		int		availableForWrite();
+		void	flush();
+		operator bool() { return true; }
+		using Print::write;
+
+		// host side
+		void	attach(SerialDevice * dev) { _dev = dev; }
+		void	echo(FILE * f) { _echo = f; }			// copy of written bytes, NULL by default
+		bool	inject(uint8_t c);						// byte coming from the device, false on overrun
+		uint16_t	rxPending() const { return _rxHead - _rxTail; }	// bytes injected and not read yet
+		unsigned long	baud() const { return _baud; }
+		uint32_t	byteTimeUs() const { return 10000000UL / _baud; }
+		uint32_t	overruns() const { return _overruns; }
+	private:
+		void		_txDrain();
+		SerialDevice *	_dev;
+		FILE *		_echo;
+		unsigned long	_baud;
+		uint8_t		_rx[SERIAL_RX_BUFFER_SIZE];
+		uint16_t	_rxHead, _rxTail;
+		uint8_t		_tx[SERIAL_TX_BUFFER_SIZE];
+		uint16_t	_txHead, _txTail;
+		uint64_t	_txNext;			// time the next byte leaves the transmit buffer
+		uint32_t	_overruns;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+extern HardwareSerial Serial3;
+
+#endif
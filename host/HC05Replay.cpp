@@ -0,0 +1,201 @@
+/* ======================================================================
+ * Replay of a captured serial session for host builds
+ * The bytes read by the MCU are fed again relative to what it writes :
+ * each read record waits for the last record written before it during
+ * the capture, then comes the same time after it, so the replay follows
+ * the MCU instead of drifting from the capture clock.
+ * ======================================================================
+ */
+#include <HC05Replay.h>
+#include <HC05c.h>
+
+#ifndef HC05_REPLAY_DIVS
+#define HC05_REPLAY_DIVS 8		// divergences kept for the report
+#endif
+
+HC05Replay::HC05Replay() {
+	_port = NULL;
+	_endT = 0;
+	_txN = 0;
+	_rxK = 0;
+	_rxPos = 0;
+	_rxAnchored = false;
+	_rxDue = 0;
+	_fed = 0;
+	_lastT = 0;
+	_divN = 0;
+	_start = _lastWall = Clock::now();
+}
+
+/* --- Read a capture : header, then tag, varint time delta and bytes
+ * per record
+ */
+bool HC05Replay::load(const char * path) {
+	std::vector<uint8_t> f;
+	uint8_t buf[512];
+	size_t n, k = 5;
+	int32_t lastTx = -1;
+	uint64_t t = 0;
+	FILE * in = fopen(path,"rb");
+	if ( in == NULL ) return false;
+	while ( ( n = fread(buf,1,sizeof(buf),in) ) > 0 ) f.insert(f.end(),buf,buf + n);
+	fclose(in);
+	if ( f.size() < 5 || memcmp(&f[0],"HC5R",4) != 0 || f[4] != HC05_CAP_VERSION ) return false;
+	while ( k < f.size() ) {
+		uint8_t kind = f[k] >> 6;
+		uint8_t len = ( f[k] & 0x3F ) + 1;
+		uint64_t dt = 0;
+		uint8_t shift = 0;
+		k++;
+		do {
+			if ( k >= f.size() || shift > 63 ) return false;
+			dt |= (uint64_t)( f[k] & 0x7F ) << shift;
+			shift += 7;
+		} while ( f[k++] & 0x80 );
+		if ( k + len > f.size() ) return false;
+		t += dt;
+		switch ( kind ) {
+			case HC05_CAP_RX : {
+				Rx r;
+				r.t = t;
+				r.anchor = lastTx;
+				r.data.assign(&f[k],&f[k] + len);
+				_rx.push_back(r);
+				break;
+			}
+			case HC05_CAP_TX :
+				lastTx = _tx.size();
+				for ( uint8_t j = 0 ; j < len ; j++ ) {
+					Item it = { false, f[k + j], t };
+					_tx.push_back(it);
+				}
+				break;
+			case HC05_CAP_BEGIN : {
+				if ( len != 4 ) return false;
+				Item it = { true, (uint32_t)f[k] | ( (uint32_t)f[k + 1] << 8 ) | ( (uint32_t)f[k + 2] << 16 ) | ( (uint32_t)f[k + 3] << 24 ), t };
+				lastTx = _tx.size();
+				_tx.push_back(it);
+				break;
+			}
+			case HC05_CAP_MARK : {
+				Mark m = { f[k], t, (uint32_t)_tx.size() };
+				_marks.push_back(m);
+				break;
+			}
+		}
+		k += len;
+		_endT = t;
+	}
+	return true;
+}
+
+void HC05Replay::attach(HardwareSerial & port) {
+	_port = &port;
+	port.attach(this);
+	_start = _lastWall = Clock::now();
+}
+
+bool HC05Replay::done() const {
+	return _txN >= _tx.size() && _rxK == _rx.size();
+}
+
+/* --- Compare what the MCU writes with the capture
+ * bytes come with the time they leave the line, one byte time after
+ * they have been written
+ */
+void HC05Replay::begin(HardwareSerial & port, unsigned long baud) {
+	(void)port;
+	_item(true,baud,host_now_us());
+}
+
+void HC05Replay::received(uint8_t c, uint64_t t_us) {
+	uint32_t bt = _port->byteTimeUs();
+	_item(false,c,( t_us > bt )?t_us - bt:0);
+}
+
+void HC05Replay::_item(bool begin, uint32_t value, uint64_t t_us) {
+	uint32_t k = _txN++;
+	_txT.push_back(t_us);
+	_txWall.push_back(Clock::now());
+	_lastT = t_us;
+	_lastWall = _txWall.back();
+	if ( k >= _tx.size() ) _diverge(begin,-1,value,t_us);
+	else if ( _tx[k].begin != begin || _tx[k].value != value ) {
+		_diverge(begin || _tx[k].begin,_tx[k].value,value,t_us);
+	}
+}
+
+void HC05Replay::_diverge(bool begin, int32_t expected, int32_t got, uint64_t t_us) {
+	if ( _div.size() < HC05_REPLAY_DIVS ) {
+		Divergence d = { _txN - 1, t_us, expected, got, begin };
+		_div.push_back(d);
+	}
+	_divN++;
+}
+
+/* --- Feed the bytes read by the MCU once their time has come
+ * at the line rate, a byte is retried while the receive buffer is full
+ */
+void HC05Replay::service() {
+	uint64_t now = host_now_us();
+	while ( _rxK < _rx.size() ) {
+		const Rx & r = _rx[_rxK];
+		if ( ! _rxAnchored ) {
+			if ( r.anchor < 0 ) _rxDue = r.t;
+			else if ( (uint32_t)r.anchor >= _txN ) return;		// waiting for what comes before
+			else _rxDue = _txT[r.anchor] + ( r.t - _tx[r.anchor].t );
+			_rxAnchored = true;
+		}
+		if ( now < _rxDue + _rxPos * _port->byteTimeUs() ) return;
+		if ( _port->rxPending() >= SERIAL_RX_BUFFER_SIZE ) return;
+		_port->inject(r.data[_rxPos]);
+		_fed++;
+		_lastT = now;
+		_lastWall = Clock::now();
+		if ( ++_rxPos == r.data.size() ) {
+			_rxK++;
+			_rxPos = 0;
+			_rxAnchored = false;
+		}
+	}
+}
+
+/* --- Replay time of a mark, NULL for the end of the capture
+ * a mark is placed the same time before the next item written as during
+ * the capture. false when the replay has not got there
+ */
+bool HC05Replay::_at(const Mark * m, double & t_ms, Clock::time_point & wall) const {
+	if ( m != NULL && m->item < _txN ) {
+		uint64_t back = _tx[m->item].t - m->t;
+		t_ms = ( ( _txT[m->item] > back )?_txT[m->item] - back:0 ) / 1000.0;
+		wall = _txWall[m->item];
+		return true;
+	}
+	if ( m != NULL && m->item < _tx.size() ) return false;
+	t_ms = _lastT / 1000.0;
+	wall = _lastWall;
+	return done();
+}
+
+std::vector<HC05Replay::Phase> HC05Replay::phases() const {
+	std::vector<Phase> v;
+	std::vector<Mark> marks = _marks;
+	if ( marks.empty() ) {
+		Mark m = { 0, 0, 0 };
+		marks.push_back(m);
+	}
+	for ( size_t k = 0 ; k < marks.size() ; k++ ) {
+		const Mark * next = ( k + 1 < marks.size() )?&marks[k + 1]:NULL;
+		Phase p;
+		double t0 = 0, t1 = 0;
+		Clock::time_point w0 = _start, w1 = _start;
+		p.id = marks[k].id;
+		p.recordedMs = ( ( ( next != NULL )?next->t:_endT ) - marks[k].t ) / 1000.0;
+		// without marks the phase starts with the replay
+		p.complete = ( _marks.empty() || _at(&marks[k],t0,w0) ) && _at(next,t1,w1);
+		p.replayMs = p.complete?t1 - t0:0;
+		p.wallMs = p.complete?std::chrono::duration<double,std::milli>(w1 - w0).count():0;
+		v.push_back(p);
+	}
+	return v;
+}
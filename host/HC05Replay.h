@@ -0,0 +1,98 @@
+/* ======================================================================
+ * Replay of a captured serial session (HC05CapturePort) for host builds
+ * Plugged on a HardwareSerial port in place of the module : the bytes the
+ * MCU read during the capture are fed back, the bytes it writes and the
+ * port restarts are compared with the captured ones.
+ * ======================================================================
+ */
+#ifndef _HC05REPLAY_H_
+#define _HC05REPLAY_H_
+
+#include <Arduino.h>
+#include <vector>
+#include <chrono>
+
+class HC05Replay : public SerialDevice
+{
+	public:
+		// -- Written item not matching the capture
+		struct Divergence {
+			uint32_t	item;			// index in the written items
+			uint64_t	t_us;			// replay time
+			int32_t		expected;		// byte, baudrate for a restart, -1 beyond the capture
+			int32_t		got;			// same
+			bool		begin;			// port restart expected or got
+		};
+		// -- Time taken by a phase, from one mark to the next
+		struct Phase {
+			uint8_t		id;				// mark id, 0 when the capture has none
+			double		recordedMs;		// during the capture
+			double		replayMs;		// virtual time of the replay
+			double		wallMs;			// host time of the replay
+			bool		complete;		// replay reached its end
+		};
+
+		HC05Replay();
+		// read a capture, false when it is not one
+		bool	load(const char * path);
+		void	attach(HardwareSerial & port);
+
+		// -- Observation
+		bool		done() const;		// every item written and every byte fed
+		uint64_t	endUs() const { return _endT; }	// capture length, virtual time
+		uint32_t	items() const { return _tx.size(); }
+		uint32_t	written() const { return _txN; }
+		uint32_t	fed() const { return _fed; }	// bytes fed to the MCU
+		uint32_t	divergences() const { return _divN + missing(); }
+		uint32_t	missing() const { return ( _txN < _tx.size() )?_tx.size() - _txN:0; }
+		const std::vector<Divergence> &	firstDivergences() const { return _div; }
+		std::vector<Phase>	phases() const;
+
+		// -- SerialDevice
+		void	begin(HardwareSerial & port, unsigned long baud);
+		void	received(uint8_t c, uint64_t t_us);
+		void	service();
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+		struct Item {					// byte written or port restart
+			bool		begin;
+			uint32_t	value;
+			uint64_t	t;				// capture time of its record
+		};
+		struct Rx {						// bytes read by the MCU
+			uint64_t	t;
+			int32_t		anchor;			// first item of the last record written before, -1 none
+			std::vector<uint8_t>	data;
+		};
+		struct Mark {
+			uint8_t		id;
+			uint64_t	t;
+			uint32_t	item;			// items written before the mark
+		};
+		void		_item(bool begin, uint32_t value, uint64_t t_us);
+		void		_diverge(bool begin, int32_t expected, int32_t got, uint64_t t_us);
+		bool		_at(const Mark * m, double & t_ms, Clock::time_point & wall) const;
+
+		HardwareSerial *	_port;
+		std::vector<Item>	_tx;
+		std::vector<Rx>		_rx;
+		std::vector<Mark>	_marks;
+		uint64_t	_endT;				// time of the last record
+		// replay
+		uint32_t	_txN;				// items written so far
+		std::vector<uint64_t>	_txT;	// replay time of each item written
+		std::vector<Clock::time_point>	_txWall;
+		size_t		_rxK;				// record being fed
+		size_t		_rxPos;				// next byte in it
+		bool		_rxAnchored;
+		uint64_t	_rxDue;				// time of its first byte once anchored
+		uint32_t	_fed;
+		uint64_t	_lastT;				// last item written or byte fed
+		Clock::time_point	_start;
+		Clock::time_point	_lastWall;
+		uint32_t	_divN;
+		std::vector<Divergence>	_div;
+};
+
+#endif
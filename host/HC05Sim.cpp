@@ -0,0 +1,366 @@
+/* ======================================================================
+ * HC-05 module simulator for host builds
+ * ======================================================================
+ */
+#include <HC05Sim.h>
+#include <algorithm>
+
+/* --- Parse an address as NAP:UAP:LAP (or with ',' separators)
+ */
+static bool parseAddr(const std::string & s, uint16_t & nap, uint8_t & uap, uint32_t & lap) {
+	unsigned int n, u, l;
+	if ( sscanf(s.c_str(),"%x%*[:,]%x%*[:,]%x",&n,&u,&l) != 3 ) return false;
+	nap = n;
+	uap = u;
+	lap = l;
+	return true;
+}
+
+HC05Sim::HC05Sim() {
+	baud = 38400;
+	atLatencyUs = 2000;
+	resetMs = 800;
+	pairMs = 3000;
+	linkMs = 1500;
+	rnameMs = 600;
+	slavePairMs = -1;
+	trace = NULL;
+	commands = 0;
+	flashWrites = 0;
+	resets = 0;
+	_port = NULL;
+	_portBaud = 0;
+	_online = true;
+	_state = "INITIALIZED";
+	_init = false;
+	_mrad = -1;
+	_inqGen = 0;
+	_eventSeq = 0;
+	_outPos = 0;
+	_lineFree = 0;
+	_garbage = 0;
+	_settings["NAME"] = "HC-05";
+	_settings["PSWD"] = "1234";
+	_settings["UART"] = "38400,0,0";
+	_settings["IAC"] = "9e8b33";
+	_settings["CMODE"] = "0";
+	_settings["ROLE"] = "0";
+	_settings["CLASS"] = "0";
+	_settings["INQM"] = "1,1,48";
+}
+
+void HC05Sim::attach(HardwareSerial & port) {
+	_port = &port;
+	_portBaud = port.baud();
+	port.attach(this);
+}
+
+HC05Sim::Device & HC05Sim::addDevice(const char * addr, uint32_t cod, int16_t rssi, uint32_t respondMs, const char * name) {
+	Device d;
+	parseAddr(addr,d.nap,d.uap,d.lap);
+	d.cod = cod;
+	d.rssi = rssi;
+	d.respondMs = respondMs;
+	d.name = name;
+	d.inRange = true;
+	d.linkOk = true;
+	_devices.push_back(d);
+	return _devices.back();
+}
+
+void HC05Sim::setLatency(const char * cmd, uint32_t us) {
+	_latencies[cmd] = us;
+}
+
+void HC05Sim::setPaired(const char * addr) {
+	Device * d = _find(addr);
+	if ( d != NULL && ! _isPaired(d) ) _paired.push_back(d - &_devices[0]);
+	if ( d != NULL ) _mrad = d - &_devices[0];
+}
+
+void HC05Sim::setState(const char * state) {
+	_state = state;
+	_init = ( _state != "INITIALIZED" );
+}
+
+/* --- Script
+ */
+void HC05Sim::at(uint32_t ms, std::function<void()> fn) {
+	_schedule((uint64_t)ms * 1000,fn);
+}
+
+void HC05Sim::disconnect() {
+	if ( _state != "CONNECTED" ) return;
+	_state = "DISCONNECTED";
+	_answer(host_now_us(),"+DISC:SUCCESS");
+}
+
+void HC05Sim::peerSend(const uint8_t * data, size_t len) {
+	if ( _state == "CONNECTED" ) _emit(host_now_us(),data,len);
+}
+
+/* --- SerialDevice
+ */
+void HC05Sim::begin(HardwareSerial & port, unsigned long rate) {
+	_port = &port;
+	_portBaud = rate;
+	_cmd.clear();
+}
+
+void HC05Sim::received(uint8_t c, uint64_t t) {
+	if ( ! _online ) return;
+	if ( _portBaud != baud ) {
+		// wrong rate : the module reads garbage and sometimes answers garbage
+		if ( ++_garbage % 4 == 0 ) {
+			uint8_t g = 0xF0;
+			_emit(t,&g,1);
+		}
+		return;
+	}
+	if ( _state == "CONNECTED" ) {
+		peerData.push_back(c);
+		return;
+	}
+	if ( c == '\r' ) return;
+	if ( c != '\n' ) {
+		if ( _cmd.size() < 128 ) _cmd += (char)c;
+		return;
+	}
+	std::string cmd = _cmd;
+	_cmd.clear();
+	_command(cmd,t);
+}
+
+void HC05Sim::service() {
+	uint64_t now = host_now_us();
+	for (;;) {
+		std::vector<Event>::iterator next = _events.end();
+		for ( std::vector<Event>::iterator e = _events.begin() ; e != _events.end() ; ++e ) {
+			if ( e->t <= now && ( next == _events.end() || e->t < next->t || ( e->t == next->t && e->seq < next->seq ) ) ) next = e;
+		}
+		if ( next == _events.end() ) break;
+		std::function<void()> fn = next->fn;
+		_events.erase(next);
+		fn();
+	}
+	while ( _outPos < _out.size() && _out[_outPos].first <= now ) {
+		if ( _port != NULL ) _port->inject(_out[_outPos].second);
+		_outPos++;
+	}
+	if ( _outPos == _out.size() ) {
+		_out.clear();
+		_outPos = 0;
+	}
+}
+
+/* --- Process an AT command received at time t
+ */
+void HC05Sim::_command(const std::string & line, uint64_t t) {
+	commands++;
+	if ( trace != NULL ) fprintf(trace,"%10.3f > %s\n",t / 1000.0,line.c_str());
+	if ( onCommand ) onCommand(line.c_str());
+	if ( line == "AT" ) {
+		_answer(t + _latency(""),"OK");
+		return;
+	}
+	if ( line.compare(0,3,"AT+") != 0 || line.size() == 3 ) {
+		_answer(t + _latency(""),"ERROR:(0)");
+		return;
+	}
+	std::string body = line.substr(3);
+	size_t sep = body.find_first_of("=?");
+	std::string key = body.substr(0,sep);
+	std::string arg = ( sep == std::string::npos )?"":body.substr(sep + 1);
+	bool query = ( sep != std::string::npos && body[sep] == '?' );
+	uint64_t ta = t + _latency(( sep == std::string::npos )?key:key + body[sep]);
+	char buf[64];
+
+	if ( key == "RESET" ) {
+		_answer(ta,"OK");
+		_online = false;
+		_inqGen++;
+		resets++;
+		_schedule(ta + (uint64_t)resetMs * 1000,[this]() {
+			_online = true;
+			_state = "INITIALIZED";
+			_init = false;
+			baud = strtoul(_settings["UART"].c_str(),NULL,10);
+			_cmd.clear();
+		});
+	} else if ( key == "INIT" ) {
+		if ( _init ) _answer(ta,"ERROR:(17)");
+		else {
+			_init = true;
+			_answer(ta,"OK");
+		}
+	} else if ( key == "STATE" && query ) {
+		_answer(ta,"+STATE:" + _state);
+		_answer(ta,"OK");
+	} else if ( key == "ADCN" && query ) {
+		snprintf(buf,sizeof(buf),"+ADCN:%u",(unsigned)_paired.size());
+		_answer(ta,buf);
+		_answer(ta,"OK");
+	} else if ( key == "MRAD" && query ) {
+		_answer(ta,"+MRAD:" + ( ( _mrad >= 0 )?_addr(&_devices[_mrad]):std::string("0:0:0") ));
+		_answer(ta,"OK");
+	} else if ( key == "INQ" ) {
+		if ( ! _init ) {
+			_answer(ta,"ERROR:(16)");
+			return;
+		}
+		uint32_t gen = ++_inqGen;
+		if ( _settings["ROLE"] == "0" ) {
+			// slave : wait for a remote to pair with us
+			_state = "PAIRABLE";
+			if ( slavePairMs >= 0 && ! _devices.empty() ) {
+				_schedule(ta + (uint64_t)slavePairMs * 1000,[this,gen]() {
+					if ( gen != _inqGen || _state != "PAIRABLE" ) return;
+					setPaired(_addr(&_devices[0]).c_str());
+					_state = "PAIRED";
+					_answer(host_now_us(),"OK");
+				});
+			}
+			return;
+		}
+		unsigned mode = 1, max = 1, timeout = 48;
+		sscanf(_settings["INQM"].c_str(),"%u,%u,%u",&mode,&max,&timeout);
+		uint64_t end = ta + (uint64_t)timeout * 1280000;
+		std::vector<size_t> order;
+		for ( size_t k = 0 ; k < _devices.size() ; k++ ) {
+			if ( _devices[k].inRange && ta + (uint64_t)_devices[k].respondMs * 1000 < end ) order.push_back(k);
+		}
+		std::sort(order.begin(),order.end(),[this](size_t a, size_t b) { return _devices[a].respondMs < _devices[b].respondMs; });
+		if ( order.size() >= max ) {
+			// the inquiry ends once max devices answered
+			order.resize(max);
+			end = ta + (uint64_t)_devices[order.back()].respondMs * 1000 + 1000;
+		}
+		_state = "INQUIRING";
+		for ( size_t k = 0 ; k < order.size() ; k++ ) {
+			const Device * d = &_devices[order[k]];
+			if ( mode == 1 ) snprintf(buf,sizeof(buf),"+INQ:%s,%X,%X",_addr(d).c_str(),d->cod,(uint16_t)d->rssi);
+			else snprintf(buf,sizeof(buf),"+INQ:%s,%X",_addr(d).c_str(),d->cod);
+			std::string res = buf;
+			_schedule(ta + (uint64_t)d->respondMs * 1000,[this,gen,res]() {
+				if ( gen == _inqGen ) _answer(host_now_us(),res);
+			});
+		}
+		_schedule(end,[this,gen]() {
+			if ( gen != _inqGen ) return;
+			_state = "INITIALIZED";
+			_answer(host_now_us(),"OK");
+		});
+	} else if ( key == "INQC" ) {
+		_inqGen++;
+		_state = "INITIALIZED";
+		_answer(ta,"OK");
+	} else if ( key == "FSAD" ) {
+		Device * d = _find(arg);
+		_answer(ta,( d != NULL && _isPaired(d) )?"OK":"FAIL");
+	} else if ( key == "PAIR" ) {
+		Device * d = _find(arg);
+		size_t comma = arg.rfind(',');
+		uint32_t limit = ( comma != std::string::npos )?strtoul(arg.c_str() + comma + 1,NULL,10) * 1000:20000;
+		bool ok = ( d != NULL && d->inRange && pairMs <= limit );
+		size_t k = ok?d - &_devices[0]:0;
+		_schedule(ta + (uint64_t)std::min(pairMs,limit) * 1000,[this,k,ok]() {
+			if ( ok && ! _isPaired(&_devices[k]) ) _paired.push_back(k);
+			_answer(host_now_us(),ok?"OK":"FAIL");
+		});
+	} else if ( key == "LINK" ) {
+		int k = _index(_find(arg));
+		_state = "CONNECTING";
+		_schedule(ta + (uint64_t)linkMs * 1000,[this,k]() {
+			Device * d = ( k >= 0 )?&_devices[k]:NULL;
+			if ( d != NULL && d->inRange && d->linkOk && _isPaired(d) ) {
+				_mrad = d - &_devices[0];
+				_state = "CONNECTED";
+				_answer(host_now_us(),"OK");
+			} else {
+				_state = _paired.empty()?"INITIALIZED":"PAIRED";
+				_answer(host_now_us(),"FAIL");
+			}
+		});
+	} else if ( key == "RNAME" && query ) {
+		int k = _index(_find(arg));
+		_schedule(ta + (uint64_t)rnameMs * 1000,[this,k]() {
+			Device * d = ( k >= 0 )?&_devices[k]:NULL;
+			if ( d != NULL && d->inRange ) {
+				_answer(host_now_us(),"+RNAME:" + d->name);
+				_answer(host_now_us(),"OK");
+			} else _answer(host_now_us(),"FAIL");
+		});
+	} else if ( key == "DISC" ) {
+		_answer(ta,"OK");
+		disconnect();
+	} else if ( _settings.count(key) != 0 && sep != std::string::npos ) {
+		if ( query ) {
+			_answer(ta,"+" + key + ":" + _settings[key]);
+		} else {
+			_settings[key] = arg;
+			flashWrites++;
+		}
+		_answer(ta,"OK");
+	} else _answer(ta,"ERROR:(0)");
+}
+
+/* --- Queue a response line for the MCU
+ */
+void HC05Sim::_answer(uint64_t t, const std::string & line) {
+	std::string out = line + "\r\n";
+	if ( trace != NULL ) fprintf(trace,"%10.3f < %s\n",t / 1000.0,line.c_str());
+	_emit(t,(const uint8_t *)out.data(),out.size());
+}
+
+/* --- Queue bytes for the MCU, sent at the line rate from time t
+ */
+void HC05Sim::_emit(uint64_t t, const uint8_t * data, size_t len) {
+	uint32_t bt = 10000000UL / baud;
+	if ( t < _lineFree ) t = _lineFree;
+	for ( size_t k = 0 ; k < len ; k++ ) {
+		t += bt;
+		_out.push_back(std::make_pair(t,data[k]));
+	}
+	_lineFree = t;
+}
+
+void HC05Sim::_schedule(uint64_t t, std::function<void()> fn) {
+	Event e;
+	e.t = t;
+	e.seq = _eventSeq++;
+	e.fn = fn;
+	_events.push_back(e);
+}
+
+uint32_t HC05Sim::_latency(const std::string & cmd) {
+	std::map<std::string,uint32_t>::const_iterator l = _latencies.find(cmd);
+	return ( l != _latencies.end() )?l->second:atLatencyUs;
+}
+
+HC05Sim::Device * HC05Sim::_find(const std::string & addr) {
+	uint16_t nap;
+	uint8_t uap;
+	uint32_t lap;
+	if ( ! parseAddr(addr,nap,uap,lap) ) return NULL;
+	for ( size_t k = 0 ; k < _devices.size() ; k++ ) {
+		if ( _devices[k].nap == nap && _devices[k].uap == uap && _devices[k].lap == lap ) return &_devices[k];
+	}
+	return NULL;
+}
+
+int HC05Sim::_index(const Device * d) {
+	return ( d != NULL )?(int)( d - &_devices[0] ):-1;
+}
+
+bool HC05Sim::_isPaired(const Device * d) {
+	for ( size_t k = 0 ; k < _paired.size() ; k++ ) {
+		if ( &_devices[_paired[k]] == d ) return true;
+	}
+	return false;
+}
+
+std::string HC05Sim::_addr(const Device * d) {
+	char buf[16];
+	snprintf(buf,sizeof(buf),"%X:%X:%X",d->nap,d->uap,d->lap);
+	return buf;
+}
@@ -0,0 +1,105 @@
+/* ======================================================================
+ * HC-05 module simulator for host builds
+ * Plugged on a HardwareSerial port of the host Arduino API, it answers the
+ * AT commands used by HC05c with configurable latencies, simulates a
+ * population of remote devices for INQ / PAIR / LINK / RNAME and carries
+ * SPP data once connected.
+ * ======================================================================
+ */
+#ifndef _HC05SIM_H_
+#define _HC05SIM_H_
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+class HC05Sim : public SerialDevice
+{
+	public:
+		// -- Remote device
+		struct Device {
+			uint16_t	nap;
+			uint8_t		uap;
+			uint32_t	lap;
+			uint32_t	cod;			// class of device
+			int16_t		rssi;
+			uint32_t	respondMs;		// delay before answering an inquiry
+			std::string	name;
+			bool		inRange;		// answers inquiries, can be paired / linked
+			bool		linkOk;			// accepts LINK
+		};
+
+		HC05Sim();
+		void	attach(HardwareSerial & port);
+
+		// -- Configuration
+		unsigned long	baud;			// module UART rate
+		uint32_t	atLatencyUs;		// answer delay of local commands
+		uint32_t	resetMs;			// reboot time after RESET
+		uint32_t	pairMs;				// PAIR duration
+		uint32_t	linkMs;				// LINK duration
+		uint32_t	rnameMs;			// RNAME duration
+		int32_t		slavePairMs;		// a remote pairs with us this long after INQ as a slave, -1 never
+		FILE *		trace;				// AT conversation is printed there when not NULL
+		std::function<void(const char *)>	onCommand;	// called for each AT command received
+		Device &	addDevice(const char * addr, uint32_t cod, int16_t rssi, uint32_t respondMs, const char * name);
+		void		setLatency(const char * cmd, uint32_t us);	// answer delay of a command ("STATE?", "INIT"...)
+		void		setPaired(const char * addr);
+		void		setState(const char * state);
+
+		// -- Script
+		void	at(uint32_t ms, std::function<void()> fn);	// run fn at virtual time ms
+		void	disconnect();									// link lost, +DISC is emitted
+		void	peerSend(const uint8_t * data, size_t len);	// remote sends SPP data
+
+		// -- Observation
+		const char *	state() const { return _state.c_str(); }
+		uint32_t	commands;			// AT commands processed
+		uint32_t	flashWrites;		// settings written
+		uint32_t	resets;
+		std::vector<uint8_t>	peerData;	// SPP data received by the remote
+
+		// -- SerialDevice
+		void	begin(HardwareSerial & port, unsigned long rate);
+		void	received(uint8_t c, uint64_t t_us);
+		void	service();
+
+	private:
+		struct Event {
+			uint64_t	t;
+			uint32_t	seq;
+			std::function<void()>	fn;
+		};
+		void		_command(const std::string & cmd, uint64_t t);
+		void		_answer(uint64_t t, const std::string & line);
+		void		_emit(uint64_t t, const uint8_t * data, size_t len);
+		void		_schedule(uint64_t t, std::function<void()> fn);
+		uint32_t	_latency(const std::string & cmd);
+		Device *	_find(const std::string & addr);
+		int			_index(const Device * d);
+		bool		_isPaired(const Device * d);
+		std::string	_addr(const Device * d);
+
+		HardwareSerial *	_port;
+		unsigned long	_portBaud;
+		bool		_online;
+		std::string	_cmd;
+		std::string	_state;
+		bool		_init;
+		std::map<std::string,std::string>	_settings;
+		std::map<std::string,uint32_t>		_latencies;
+		std::vector<Device>		_devices;
+		std::vector<size_t>		_paired;		// index in _devices
+		int			_mrad;
+		uint32_t	_inqGen;				// cancels pending inquiry events
+		std::vector<Event>	_events;
+		uint32_t	_eventSeq;
+		std::vector<std::pair<uint64_t,uint8_t> >	_out;	// bytes to the MCU and their time
+		size_t		_outPos;
+		uint64_t	_lineFree;				// time the line to the MCU is free
+		uint32_t	_garbage;
+};
+
+#endif
@@ -0,0 +1,407 @@
+/* ======================================================================
+ * HC05c benchmarks against the simulated module, in virtual time
+ * Each phase is run several times with randomized module latencies and
+ * device populations, p50 / p99 are printed as one JSON object per line.
+ *
+ *   hc05c_bench [runs] [seed]
+ * ======================================================================
+ */
+#include <HC05c.h>
+#include <HC05Sim.h>
+#include <vector>
+#include <algorithm>
+
+static const unsigned long RATES[] = { 9600, 19200, 38400, 57600, 115200 };
+
+static uint32_t _seed = 1;
+
+/* --- Deterministic pseudo random in [lo,hi]
+ */
+static uint32_t rnd(uint32_t lo, uint32_t hi) {
+	_seed = _seed * 1103515245 + 12345;
+	return lo + ( _seed >> 8 ) % ( hi - lo + 1 );
+}
+
+static double now_ms() {
+	return host_now_us() / 1000.0;
+}
+
+static void report(const char * bench, const char * extra, std::vector<double> & v) {
+	std::sort(v.begin(),v.end());
+	size_t n = v.size();
+	printf("{\"bench\":\"%s\"%s,\"unit\":\"ms\",\"runs\":%u,\"p50\":%.3f,\"p99\":%.3f,\"min\":%.3f,\"max\":%.3f}\n",
+		bench,extra,(unsigned)n,v[n / 2],v[( n * 99 ) / 100 < n ? ( n * 99 ) / 100 : n - 1],v[0],v[n - 1]);
+	fflush(stdout);
+}
+
+/* --- Module with randomized latencies and a few devices around
+ */
+static void setupSim(HC05Sim & sim, unsigned long rate) {
+	char addr[32];
+	sim.baud = rate;
+	snprintf(addr,sizeof(addr),"UART=%lu,0,0",rate);
+	sim.atLatencyUs = rnd(1000,6000);
+	sim.resetMs = rnd(500,1500);
+	sim.pairMs = rnd(1500,5000);
+	sim.linkMs = rnd(800,3000);
+	uint8_t n = rnd(1,6);
+	for ( uint8_t k = 0 ; k < n ; k++ ) {
+		snprintf(addr,sizeof(addr),"%X:%X:%X",rnd(1,0xFFFF),rnd(0,0xFF),rnd(1,0xFFFFFF));
+		sim.addDevice(addr,0x1F00,-(int16_t)rnd(40,90),rnd(300,20000),"DEV");
+	}
+	sim.attach(Serial1);
+}
+
+static HC05Config config(unsigned long rate) {
+	HC05Config cfg;
+	cfg.name = "test";
+	cfg.passwd = "1234";
+	cfg.uart = rate;
+	cfg.iac = "9e8b33";
+	cfg.cmode = 1;
+	return cfg;
+}
+
+/* --- setupConnection() on a module in factory settings and on a module
+ * already configured
+ */
+static void benchSetup(int runs) {
+	std::vector<double> cold, warm;
+	for ( int r = 0 ; r < runs ; r++ ) {
+		HC05Sim sim;
+		HC05c hc05;
+		setupSim(sim,38400);
+		double t0 = now_ms();
+		hc05.setupConnection(config(38400));
+		cold.push_back(now_ms() - t0);
+		HC05c again;
+		t0 = now_ms();
+		again.setupConnection(config(38400));
+		warm.push_back(now_ms() - t0);
+	}
+	report("setup_cold","",cold);
+	report("setup_warm","",warm);
+}
+
+// -- Storage kept in RAM
+class MemStorage : public HC05Storage
+{
+	public:
+		MemStorage() : _len(0) {}
+		bool	load(void * data, uint16_t len) {
+			if ( len != _len ) return false;
+			memcpy(data,_data,len);
+			return true;
+		}
+		void	save(const void * data, uint16_t len) {
+			_len = ( len < sizeof(_data) )?len:sizeof(_data);
+			memcpy(_data,data,_len);
+		}
+	private:
+		uint8_t		_data[64];
+		uint16_t	_len;
+};
+
+/* --- Baudrate detection : setupConnection() until the first command
+ * following the probe, module at each supported rate. Cold : nothing
+ * known, cached : the rate found by a previous run is in the storage
+ */
+static void benchProbe(int runs) {
+	for ( size_t k = 0 ; k < sizeof(RATES) / sizeof(RATES[0]) ; k++ ) {
+		std::vector<double> v, cached;
+		int failed = 0;
+		for ( int r = 0 ; r < runs ; r++ ) {
+			HC05Sim sim;
+			MemStorage mem;
+			HC05c hc05, next;
+			double t0 = now_ms(), found = -1;
+			setupSim(sim,RATES[k]);
+			sim.onCommand = [&](const char * cmd) { if ( found < 0 && strcmp(cmd,"AT") != 0 ) found = now_ms(); };
+			hc05.setBaudStorage(&mem);
+			if ( hc05.setupConnection(config(RATES[k])) && found >= 0 ) v.push_back(found - t0);
+			else failed++;
+			next.setBaudStorage(&mem);
+			t0 = now_ms();
+			found = -1;
+			if ( next.setupConnection(config(RATES[k])) && found >= 0 ) cached.push_back(found - t0);
+		}
+		if ( ! cached.empty() ) {
+			char extra[32];
+			snprintf(extra,sizeof(extra),",\"baud\":%lu",RATES[k]);
+			report("baud_probe_cached",extra,cached);
+		}
+		if ( v.empty() ) {
+			printf("{\"bench\":\"baud_probe\",\"baud\":%lu,\"runs\":%d,\"failed\":%d}\n",RATES[k],runs,failed);
+		} else {
+			char extra[48];
+			snprintf(extra,sizeof(extra),",\"baud\":%lu,\"failed\":%d",RATES[k],failed);
+			report("baud_probe",extra,v);
+		}
+	}
+}
+
+/* --- AT round trip : refreshState() (AT+STATE?)
+ */
+static void benchRoundTrip(int runs) {
+	std::vector<double> v;
+	for ( int r = 0 ; r < runs ; r++ ) {
+		HC05Sim sim;
+		HC05c hc05;
+		setupSim(sim,38400);
+		hc05.setupConnection(config(38400));
+		for ( int k = 0 ; k < 10 ; k++ ) {
+			double t0 = now_ms();
+			hc05.refreshState();
+			v.push_back(now_ms() - t0);
+		}
+	}
+	report("at_roundtrip","",v);
+}
+
+/* --- connect() : nothing paired, slave wait then master inquiry / pair / link,
+ * a module already paired with a device in range (MRAD link), the recovery
+ * of that link after +DISC and after the device left the range for a while
+ */
+static void benchConnect(int runs) {
+	std::vector<double> master, paired, reconnect, dropout, tickMax;
+	HC05Recovery tiers;
+	memset(&tiers,0,sizeof(tiers));
+	for ( int r = 0 ; r < runs ; r++ ) {
+		HC05Sim sim;
+		HC05c hc05;
+		setupSim(sim,38400);
+		hc05.setupConnection(config(38400));
+		double t0 = now_ms(), worst = 0;
+		for (;;) {
+			double t = now_ms();
+			if ( hc05.poll() ) break;
+			if ( now_ms() - t > worst ) worst = now_ms() - t;
+		}
+		master.push_back(now_ms() - t0);
+		tickMax.push_back(worst);
+	}
+	for ( int r = 0 ; r < runs ; r++ ) {
+		HC05Sim sim;
+		HC05c hc05;
+		char addr[32];
+		setupSim(sim,38400);
+		snprintf(addr,sizeof(addr),"%X:%X:%X",rnd(1,0xFFFF),rnd(0,0xFF),rnd(1,0xFFFFFF));
+		HC05Sim::Device & peer = sim.addDevice(addr,0x1F00,-50,500,"PEER");
+		sim.setPaired(addr);
+		hc05.setupConnection(config(38400));
+		double t0 = now_ms();
+		while ( ! hc05.poll() ) ;
+		paired.push_back(now_ms() - t0);
+		sim.disconnect();
+		t0 = now_ms();
+		while ( hc05.receive(addr,sizeof(addr)) >= 0 ) ;   // until +DISC is seen
+		while ( ! hc05.poll() ) ;
+		reconnect.push_back(now_ms() - t0);
+		sim.disconnect();
+		peer.inRange = false;
+		sim.at(now_ms() + rnd(200,10000),[&peer]() { peer.inRange = true; });
+		t0 = now_ms();
+		while ( hc05.receive(addr,sizeof(addr)) >= 0 ) ;
+		while ( ! hc05.poll() ) ;
+		dropout.push_back(now_ms() - t0);
+		const HC05Recovery & rec = hc05.recovery();
+		for ( uint8_t k = 0 ; k < HC05_REC_TIERS ; k++ ) {
+			tiers.ms[k] += rec.ms[k];
+			tiers.ok[k] += rec.ok[k];
+		}
+	}
+	report("connect_master","",master);
+	report("connect_paired","",paired);
+	report("reconnect_disc","",reconnect);
+	report("reconnect_dropout","",dropout);
+	printf("{\"bench\":\"recovery_tiers\",\"link_ms\":%u,\"init_ms\":%u,\"reset_ms\":%u,\"ok_link\":%u,\"ok_init\":%u,\"ok_reset\":%u}\n",
+		(unsigned)tiers.ms[HC05_REC_LINK],(unsigned)tiers.ms[HC05_REC_INIT],(unsigned)tiers.ms[HC05_REC_RESET],
+		tiers.ok[HC05_REC_LINK],tiers.ok[HC05_REC_INIT],tiers.ok[HC05_REC_RESET]);
+	report("poll_latency_max","",tickMax);
+}
+
+/* --- SPP throughput at each rate, once connected
+ * tx : write() from the MCU until the remote received everything
+ * rx : the remote sends, the MCU loops on receive() as HC05c.ino does
+ */
+static void benchThroughput() {
+	static const size_t TOTAL = 32768;
+	static uint8_t payload[TOTAL];
+	for ( size_t k = 0 ; k < TOTAL ; k++ ) payload[k] = k * 7;
+	for ( size_t k = 0 ; k < sizeof(RATES) / sizeof(RATES[0]) ; k++ ) {
+		HC05Sim sim;
+		HC05c hc05;
+		char buf[50];
+		char addr[] = "1234:56:789ABC";
+		setupSim(sim,RATES[k]);
+		sim.addDevice(addr,0x1F00,-50,500,"PEER");
+		sim.setPaired(addr);
+		if ( ! hc05.setupConnection(config(RATES[k])) ) {
+			printf("{\"bench\":\"spp_throughput\",\"baud\":%lu,\"failed\":1}\n",RATES[k]);
+			continue;
+		}
+		while ( ! hc05.poll() ) ;
+
+		// tx
+		size_t sent = 0;
+		double t0 = now_ms();
+		while ( sent < TOTAL ) {
+			sent += hc05.write(payload + sent,TOTAL - sent);
+			hc05.poll();
+		}
+		while ( sim.peerData.size() < TOTAL ) hc05.poll();
+		double tx = now_ms() - t0;
+
+		// rx
+		size_t got = 0;
+		uint32_t overruns = Serial1.overruns();
+		sim.peerSend(payload,TOTAL);
+		t0 = now_ms();
+		double last = t0;
+		while ( now_ms() - last < 500 ) {
+			int16_t n = hc05.receive(buf,sizeof(buf));
+			if ( n > 0 ) {
+				got += n;
+				last = now_ms();
+			}
+			if ( got >= TOTAL ) break;
+		}
+		double rx = last - t0;
+		printf("{\"bench\":\"spp_throughput\",\"baud\":%lu,\"tx_bytes_per_s\":%.0f,\"rx_bytes_per_s\":%.0f,\"rx_lost\":%u,\"rx_overruns\":%u}\n",
+			RATES[k],TOTAL / ( tx / 1000.0 ),got / ( rx / 1000.0 ),(unsigned)( TOTAL - got ),(unsigned)( Serial1.overruns() - overruns ));
+		fflush(stdout);
+	}
+}
+
+/* --- Several modules driven by one HC05Scheduler : time until every link
+ * is up, then aggregate receive throughput at 115200
+ */
+static void benchMultiLink(int runs) {
+	static const size_t TOTAL = 16384;
+	static uint8_t payload[TOTAL];
+	HardwareSerial * ports[] = { &Serial1, &Serial2, &Serial3 };
+	for ( size_t k = 0 ; k < TOTAL ; k++ ) payload[k] = k * 3;
+	for ( uint8_t n = 1 ; n <= 3 ; n++ ) {
+		std::vector<double> up, rate;
+		for ( int r = 0 ; r < runs ; r++ ) {
+			HC05Sim sim[3];
+			HC05cT<HardwareSerial> l1(Serial1), l2(Serial2), l3(Serial3);
+			HC05cT<HardwareSerial> * hc05[3] = { &l1, &l2, &l3 };
+			HC05Scheduler sched;
+			size_t got[3] = { 0, 0, 0 }, all = 0;
+			char buf[64];
+			for ( uint8_t k = 0 ; k < n ; k++ ) {
+				char addr[32];
+				snprintf(addr,sizeof(addr),"%X:%X:%X",rnd(1,0xFFFF),rnd(0,0xFF),rnd(1,0xFFFFFF));
+				sim[k].baud = 115200;
+				sim[k].atLatencyUs = rnd(1000,6000);
+				sim[k].linkMs = rnd(800,3000);
+				sim[k].addDevice(addr,0x1F00,-50,500,"PEER");
+				sim[k].setPaired(addr);
+				sim[k].attach(*ports[k]);
+				hc05[k]->setupConnection(config(115200));
+				sched.add(hc05[k],60000);
+			}
+			double t0 = now_ms();
+			for (;;) {
+				uint8_t k = 0;
+				sched.run();
+				while ( k < n && sched.connected(k) ) k++;
+				if ( k == n ) break;
+			}
+			up.push_back(now_ms() - t0);
+			for ( uint8_t k = 0 ; k < n ; k++ ) sim[k].peerSend(payload,TOTAL);
+			t0 = now_ms();
+			while ( all < n * TOTAL && now_ms() - t0 < 10000 ) {
+				sched.run();
+				for ( uint8_t k = 0 ; k < n ; k++ ) {
+					int16_t len = hc05[k]->receive(buf,sizeof(buf));
+					if ( len > 0 ) {
+						got[k] += len;
+						all += len;
+					}
+				}
+			}
+			rate.push_back(all / ( ( now_ms() - t0 ) / 1000.0 ));
+		}
+		char extra[48];
+		snprintf(extra,sizeof(extra),",\"links\":%u",n);
+		report("multi_link_up",extra,up);
+		std::sort(rate.begin(),rate.end());
+		printf("{\"bench\":\"multi_link_rx\",\"links\":%u,\"baud\":115200,\"bytes_per_s\":%.0f}\n",n,rate[rate.size() / 2]);
+	}
+}
+
+/* --- HC05Framer at 115200 bauds with small payloads
+ * tx : frames queued by HC05Framer, against one send() per message
+ * rx : the remote sends frames, one in 50 has a byte corrupted
+ */
+static void benchFrames() {
+	static const int N = 1000;
+	static const uint8_t LEN = 8;
+	HC05Sim sim;
+	HC05c hc05;
+	HC05Framer framer(hc05);
+	uint8_t msg[LEN];
+	char addr[] = "1234:56:789ABC";
+	setupSim(sim,115200);
+	sim.addDevice(addr,0x1F00,-50,500,"PEER");
+	sim.setPaired(addr);
+	if ( ! hc05.setupConnection(config(115200)) ) {
+		printf("{\"bench\":\"frames\",\"baud\":115200,\"failed\":1}\n");
+		return;
+	}
+	while ( ! hc05.poll() ) ;
+	for ( uint8_t k = 0 ; k < LEN ; k++ ) msg[k] = k;
+
+	// tx : raw messages, then frames
+	double t0 = now_ms();
+	for ( int k = 0 ; k < N ; k++ ) hc05.send(msg,LEN);
+	while ( sim.peerData.size() < (size_t)N * LEN ) hc05.poll();
+	double raw = now_ms() - t0;
+	sim.peerData.clear();
+	t0 = now_ms();
+	for ( int k = 0 ; k < N ; k++ ) {
+		while ( ! framer.send(msg,LEN) ) ;
+	}
+	while ( sim.peerData.size() < (size_t)N * ( LEN + 4 ) ) framer.flush();
+	double tx = now_ms() - t0;
+
+	// rx
+	std::vector<uint8_t> stream;
+	uint8_t frame[LEN + 4];
+	for ( int k = 0 ; k < N ; k++ ) {
+		msg[0] = k;
+		HC05Framer::encode(frame,msg,LEN);
+		if ( k % 50 == 49 ) frame[3] ^= 0x10;
+		stream.insert(stream.end(),frame,frame + sizeof(frame));
+	}
+	int got = 0;
+	const uint8_t * data;
+	sim.peerSend(&stream[0],stream.size());
+	t0 = now_ms();
+	double last = t0;
+	while ( now_ms() - last < 500 ) {
+		if ( framer.recv(&data) == LEN ) {
+			got++;
+			last = now_ms();
+		}
+	}
+	double rx = last - t0;
+	printf("{\"bench\":\"frames\",\"baud\":115200,\"payload\":%u,\"tx_raw_msgs_per_s\":%.0f,\"tx_frames_per_s\":%.0f,\"rx_frames_per_s\":%.0f,\"rx_crc_errors\":%u,\"rx_lost\":%u}\n",
+		LEN,N / ( raw / 1000.0 ),N / ( tx / 1000.0 ),got / ( rx / 1000.0 ),framer.crcErrors(),(unsigned)( N - N / 50 - got ));
+	fflush(stdout);
+}
+
+int main(int argc, char ** argv) {
+	int runs = ( argc > 1 )?atoi(argv[1]):20;
+	_seed = ( argc > 2 )?atoi(argv[2]):1;
+	benchSetup(runs);
+	benchProbe(runs);
+	benchRoundTrip(runs);
+	benchConnect(runs);
+	benchThroughput();
+	benchFrames();
+	benchMultiLink(runs);
+	return 0;
+}
@@ -0,0 +1,140 @@
+/* ======================================================================
+ * HC05c against the simulated module : setup, pairing as a master,
+ * SPP data both ways and link loss, in virtual time.
+ * ======================================================================
+ */
+#include <HC05c.h>
+#include <HC05Sim.h>
+
+#if HC05_LOG_LEVEL > 0
+#define LOG_TEXT(id, fmt) fmt,
+static const char * const LOG_FMT[] = { HC05_LOG_MESSAGES(LOG_TEXT) };
+
+/* --- Print the log records queued by the library
+ */
+class LogDecoder : public Print
+{
+	public:
+		LogDecoder() : _n(0) {}
+		size_t write(uint8_t c) {
+			_rec[_n++] = c;
+			if ( _n < sizeof(_rec) ) return 1;
+			uint32_t ms = 0, v = 0;
+			for ( int k = 3 ; k >= 0 ; k-- ) {
+				ms = ( ms << 8 ) | _rec[1 + k];
+				v = ( v << 8 ) | _rec[5 + k];
+			}
+			printf("%10.3f log ",ms / 1000.0);
+			if ( _rec[0] >= HC05_LG_COUNT ) printf("unknown id %u",_rec[0]);
+			else if ( strstr(LOG_FMT[_rec[0]],"%.4s") != NULL ) printf(LOG_FMT[_rec[0]],(const char *)&_rec[5]);
+			else printf(LOG_FMT[_rec[0]],(long)(int32_t)v);
+			printf("\n");
+			_n = 0;
+			return 1;
+		}
+		using Print::write;
+	private:
+		uint8_t	_rec[9];
+		uint8_t	_n;
+};
+#endif
+
+static void drainLog() {
+#if HC05_LOG_LEVEL > 0
+	static LogDecoder decoder;
+	HC05Log::drain(decoder,255);
+#endif
+}
+
+static HC05c hc05;
+
+/* --- Ask for the name of each device found, it is resolved before the
+ * next detected device is processed
+ */
+static bool onDevice(const HC05Addr & addr, uint32_t cod, int16_t rssi) {
+	(void)cod;
+	(void)rssi;
+	hc05.requestName(addr);
+	return false;
+}
+
+int main(int argc, char ** argv) {
+	HC05Sim sim;
+	char buf[64];
+	int16_t n;
+	bool trace = ( argc > 1 && strcmp(argv[1],"-v") == 0 );
+
+	sim.trace = trace?stdout:NULL;
+	const char * devs[] = { "98D3:31:B2140E", "2:72:D2224" };
+
+	sim.addDevice(devs[0],0x1F00,-62,2200,"PEER-1");
+	sim.addDevice(devs[1],0x5A020C,-80,900,"PHONE");
+	sim.attach(Serial1);
+
+	hc05.onInquiry(onDevice);
+	hc05.setupConnection("test");
+	drainLog();
+	printf("setupConnection : %8.1f ms\n",host_now_us() / 1000.0);
+	while ( ! hc05.poll() ) drainLog();
+	drainLog();
+	printf("connected       : %8.1f ms (module %s)\n",host_now_us() / 1000.0,sim.state());
+
+	for ( uint8_t k = 0 ; k < 2 ; k++ ) {
+		HC05Addr addr;
+		const char * name;
+		addr.parse(devs[k]);
+		name = hc05.remoteName(addr);
+		printf("remote name     : %-14s %s\n",devs[k],( name != NULL )?name:"(unknown)");
+	}
+
+	printf("timeouts        : AT %u ms, RESET %u ms, INIT %u ms\n",(unsigned)hc05.timeout(HC05_TO_AT).timeout(),
+		(unsigned)hc05.timeout(HC05_TO_RESET).timeout(),(unsigned)hc05.timeout(HC05_TO_INIT).timeout());
+
+	hc05.send("hello");
+	sim.peerSend((const uint8_t *)"world",5);
+	delay(10);
+	n = hc05.receive(buf,sizeof(buf));
+	printf("received        : %d bytes '%s', remote got %u bytes\n",n,buf,(unsigned)sim.peerData.size());
+
+	// a frame whose CRC ends in '+', the start of "+DISC:", then nothing
+	HC05Framer framer(hc05);
+	const uint8_t * data;
+	uint8_t msg[4] = { 0, 0, 0, 0 };
+	uint8_t frame[sizeof(msg) + 4];
+	do {
+		if ( ++msg[0] == 0 ) msg[1]++;
+		HC05Framer::encode(frame,msg,sizeof(msg));
+	} while ( frame[sizeof(frame) - 1] != '+' );
+	sim.peerSend(frame,sizeof(frame));
+	uint32_t start = millis();
+	while ( ( n = framer.recv(&data) ) < 0 && millis() - start < 100 ) ;
+	framer.release();
+	printf("framed          : %d bytes, CRC ending in 0x2B, after %u ms\n",n,(unsigned)( millis() - start ));
+	if ( n != sizeof(msg) ) return 1;
+
+	sim.disconnect();
+	delay(10);
+	printf("after +DISC     : receive() = %d\n",hc05.receive(buf,sizeof(buf)));
+	while ( ! hc05.poll() ) drainLog();
+	drainLog();
+	const HC05Recovery & rec = hc05.recovery();
+	printf("reconnected     : %8.1f ms after +DISC (LINK %u ms, INIT %u ms, RESET %u ms)\n",(double)rec.lastMs,
+		(unsigned)rec.ms[HC05_REC_LINK],(unsigned)rec.ms[HC05_REC_INIT],(unsigned)rec.ms[HC05_REC_RESET]);
+#ifdef HC05_METRICS
+	const HC05Metrics & m = hc05.metrics();
+	printf("\n%-6s %6s %6s %8s %8s %8s\n","cmd","count","errors","timeouts","min ms","max ms");
+	for ( uint8_t k = 0 ; k < HC05_CMD_COUNT ; k++ ) {
+		const HC05CmdStats & st = m.command(k);
+		if ( st.count == 0 ) continue;
+		printf("%-6s %6u %6u %8u %8u %8u\n",HC05Metrics::commandName(k),st.count,st.errors,st.timeouts,
+			( st.min_ms == 0xFFFF )?0:st.min_ms,st.max_ms);
+	}
+	printf("bytes in %u out %u\n",(unsigned)m.bytesIn(),(unsigned)m.bytesOut());
+	for ( int8_t k = m.events() - 1 ; k >= 0 ; k-- ) {
+		const HC05Event & e = m.event(k);
+		if ( e.type == HC05_EV_STATE ) printf("%10.3f state %d -> %d\n",e.ms / 1000.0,e.a,e.b);
+		else printf("%10.3f %s error %d\n",e.ms / 1000.0,HC05Metrics::commandName(e.a),e.b);
+	}
+#endif
+	return 0;
+}
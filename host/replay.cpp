@@ -0,0 +1,135 @@
+/* ======================================================================
+ * Capture and replay of a serial session, in virtual time
+ *
+ *   hc05c_replay -r file    run the session against HC05Sim and capture it
+ *                           with HC05CapturePort
+ *   hc05c_replay file       run the same session on an unmodified HC05c
+ *                           fed by the capture
+ *
+ * The replay prints one JSON object per line : the summary, the first
+ * divergences between what HC05c writes and the capture, then the time of
+ * each marked phase (captured, replayed in virtual time, host wall time).
+ * It exits with 1 when the session diverged.
+ * ======================================================================
+ */
+#include <HC05c.h>
+#include <HC05Sim.h>
+#include <HC05Replay.h>
+
+#define SESSION_LIMIT_US	600000000ULL	// a diverging replay stops there
+
+// -- Phase marks, then what the remote side does during the session
+#define PH_SETUP	1
+#define PH_CONNECT	2
+#define PH_DATA		3
+#define PH_RECOVERY	4
+#define EV_PEER_SEND	10
+#define EV_LINK_LOST	11
+
+static const char * const PHASES[] = { "none", "setup", "connect", "data", "recovery" };
+
+/* --- Capture written to a file
+ */
+class FilePrint : public Print
+{
+	public:
+		FilePrint(FILE * f) : _f(f) {}
+		size_t write(uint8_t c) { return ( fputc(c,_f) == EOF )?0:1; }
+		using Print::write;
+	private:
+		FILE *	_f;
+};
+
+static HC05Sim * _sim;
+static HC05CapturePort<HardwareSerial> * _cap;
+
+/* --- Marks and remote side while capturing, nothing on replay : the
+ * remote side comes from the capture
+ */
+static void event(uint8_t ev) {
+	if ( _sim == NULL ) return;
+	if ( ev == EV_PEER_SEND ) _sim->peerSend((const uint8_t *)"world",5);
+	else if ( ev == EV_LINK_LOST ) _sim->disconnect();
+	else _cap->mark(ev);
+}
+
+/* --- The session : setup, connection as a master, data both ways, link
+ * loss and recovery. It waits for what it expects instead of fixed
+ * delays, so the replay does not depend on when bytes are fed
+ */
+template<class Driver>
+static bool session(Driver & hc05) {
+	char buf[16];
+	int16_t n, got;
+	event(PH_SETUP);
+	hc05.setupConnection("test");
+	event(PH_CONNECT);
+	while ( ! hc05.poll() ) if ( host_now_us() > SESSION_LIMIT_US ) return false;
+	event(PH_DATA);
+	hc05.send("hello");
+	event(EV_PEER_SEND);
+	for ( got = 0 ; got < 5 ; got += n ) {
+		if ( ( n = hc05.receive(&buf[got],sizeof(buf) - got) ) < 0 || host_now_us() > SESSION_LIMIT_US ) return false;
+	}
+	if ( memcmp(buf,"world",5) != 0 ) return false;
+	event(PH_RECOVERY);
+	event(EV_LINK_LOST);
+	while ( hc05.receive(buf,sizeof(buf)) >= 0 ) if ( host_now_us() > SESSION_LIMIT_US ) return false;
+	while ( ! hc05.poll() ) if ( host_now_us() > SESSION_LIMIT_US ) return false;
+	return true;
+}
+
+static int record(const char * path) {
+	HC05Sim sim;
+	FILE * f = fopen(path,"wb");
+	if ( f == NULL ) {
+		fprintf(stderr,"cannot write %s\n",path);
+		return 2;
+	}
+	FilePrint out(f);
+	HC05CapturePort<HardwareSerial> cap(blueToothSerial,out);
+	HC05cT< HC05CapturePort<HardwareSerial> > hc05(cap);
+	sim.addDevice("98D3:31:B2140E",0x1F00,-62,2200,"PEER-1");
+	sim.addDevice("2:72:D2224",0x5A020C,-80,900,"PHONE");
+	sim.attach(blueToothSerial);
+	_sim = &sim;
+	_cap = &cap;
+	bool ok = session(hc05);
+	cap.flush();
+	fclose(f);
+	printf("{\"capture\":\"%s\",\"ok\":%s,\"session_ms\":%.3f,\"bytes\":%u}\n",path,ok?"true":"false",
+		host_now_us() / 1000.0,(unsigned)cap.size());
+	return ok?0:1;
+}
+
+static int replay(const char * path) {
+	HC05Replay rep;
+	if ( ! rep.load(path) ) {
+		fprintf(stderr,"%s is not a capture\n",path);
+		return 2;
+	}
+	HC05c hc05;
+	rep.attach(blueToothSerial);
+	bool ok = session(hc05);
+	printf("{\"replay\":\"%s\",\"ok\":%s,\"items\":%u,\"written\":%u,\"fed\":%u,\"divergences\":%u,\"missing\":%u}\n",
+		path,ok?"true":"false",rep.items(),rep.written(),rep.fed(),rep.divergences(),rep.missing());
+	for ( size_t k = 0 ; k < rep.firstDivergences().size() ; k++ ) {
+		const HC05Replay::Divergence & d = rep.firstDivergences()[k];
+		printf("{\"divergence\":%u,\"t_ms\":%.3f,\"begin\":%s,\"expected\":%d,\"got\":%d}\n",d.item,d.t_us / 1000.0,
+			d.begin?"true":"false",d.expected,d.got);
+	}
+	std::vector<HC05Replay::Phase> ph = rep.phases();
+	for ( size_t k = 0 ; k < ph.size() ; k++ ) {
+		printf("{\"phase\":\"%s\",\"recorded_ms\":%.3f,\"replay_ms\":%.3f,\"wall_ms\":%.3f,\"complete\":%s}\n",
+			( ph[k].id <= PH_RECOVERY )?PHASES[ph[k].id]:"mark",ph[k].recordedMs,ph[k].replayMs,ph[k].wallMs,
+			ph[k].complete?"true":"false");
+	}
+	return ( ok && rep.divergences() == 0 )?0:1;
+}
+
+int main(int argc, char ** argv) {
+	if ( argc == 3 && strcmp(argv[1],"-r") == 0 ) return record(argv[2]);
+	if ( argc == 2 ) return replay(argv[1]);
+	fprintf(stderr,"usage : %s [-r] capture\n",argv[0]);
+	return 2;
+}